@@ -1,37 +1,68 @@
 #include "AVPlayer.h"
 #include "MsgBox.h"
+#include "VideoFrame.h"
+#include "FrameBufferPool.h"
+#include "VideoPresenter.h"
 #include "ThreadPool.h"
-#include "YUV422Frame.h"
 #include <QFileInfo>
 #include <QsLog.h>
 #include <QThread>
+#include <chrono>
 
 AVPlayer::AVPlayer(QObject *parent)
     :QObject(parent) ,
       m_decoder(new Decoder),
+      m_nextDecoder(new Decoder),
+      m_audioDecoder(m_decoder),
+      m_videoDecoder(m_decoder),
+      m_audioClockDecoder(nullptr),
+      m_nextReady(false),
+      m_nextPending(false),
+      m_playlistIndex(-1),
+      m_nextIndex(-1),
+      m_playlistLoop(false),
+      m_state(AV_STOPPED),
+      m_deviceFreq(0),
+      m_deviceChannels(0),
       m_duration(0),
       m_pause(false),
+      m_seekPending(false),
+      m_seekPendingTarget(0.0),
+      m_lastVideoSerial(0),
+      m_audioClockSerial(-1),
+      m_liveDropFrames(0),
+      m_liveDropLogTime(0.0),
+      m_syncPending(false),
+      m_playStartTime(0),
+      m_firstFramePending(false),
       m_exit(false),
       m_audioBuf(nullptr),
-      m_fmtCtx(nullptr),
       m_swsCtx(nullptr),
       m_swrCtx(nullptr),
       m_volume(50),
-      m_videoBuf(nullptr)
+      m_imageWidth(0),
+      m_imageHeight(0),
+      m_imageFormat(AV_PIX_FMT_NONE)
 {
     m_audioFrame = av_frame_alloc();
+    connect(this, &AVPlayer::itemHandover, this, &AVPlayer::finishHandover, Qt::QueuedConnection);
 }
 
 AVPlayer::~AVPlayer()
 {
+    initPlayer(); // 先停止音频回调和视频线程, 再释放它们使用的资源
+    closeAudioDevice();
     if(m_audioFrame){
         av_frame_free(&m_audioFrame);
     }
-    initPlayer();
     if(m_decoder){
         delete m_decoder;
         m_decoder = nullptr;
     }
+    if(m_nextDecoder){
+        delete m_nextDecoder;
+        m_nextDecoder = nullptr;
+    }
     if(m_swrCtx){
         swr_free(&m_swrCtx);
     }
@@ -41,56 +72,61 @@ AVPlayer::~AVPlayer()
     if(m_audioBuf){
         av_free(m_audioBuf);
     }
-    if(m_videoBuf){
-        av_free(m_videoBuf);
-    }
 }
 
 void AVPlayer::initPlayer()
 {
     if(getState() != AVPlayer::AV_STOPPED){
-        m_exit = true;
-        if(getState() == AVPlayer::AV_PLAYING){
-            SDL_PauseAudio(1); //停止音频
+        {
+            std::lock_guard<std::mutex> lock(m_pauseMutex);
+            m_exit = true;
+        }
+        m_pauseCond.notify_all();
+        // 设备保持打开, 暂停返回时音频回调已结束且不会再被调用
+        SDL_PauseAudio(1);
+        m_decoder->stop(); // 唤醒阻塞在帧队列上的视频线程
+        m_nextDecoder->stop();
+        m_threads.joinAll();
+        m_preloadThreads.joinAll();
+        logLiveDrops();
+        if(VideoPresenter *presenter = m_presenter.load()){
+            presenter->flushFrames();
         }
         m_decoder->exit();
-        SDL_CloseAudio();
+        m_nextDecoder->exit();
+        m_nextReady.store(false);
+        m_nextPending.store(false);
+        m_audioDecoder.store(m_decoder);
+        m_videoDecoder.store(m_decoder);
+        m_audioClockDecoder.store(nullptr);
         if(m_swrCtx){
             swr_free(&m_swrCtx);
         }
         if(m_swsCtx){
             sws_freeContext(m_swsCtx);
+            FrameBufferPool::Stats stats = FrameBufferPool::instance().stats();
+            QLOG_INFO() << "frame buffer pool: hits" << stats.hits << "misses" << stats.misses
+                        << "peak outstanding" << stats.peakOutstanding;
+            FrameBufferPool::instance().clear();
         }
 //      if(m_audioBuf){
 //          av_free(m_audioBuf);
 //      }
-      if(m_videoBuf){
-          av_free(m_videoBuf);
-      }
+        m_imageWidth = 0;
+        m_imageHeight = 0;
+        m_imageFormat = AV_PIX_FMT_NONE;
         m_swrCtx = nullptr;
         m_swsCtx = nullptr;
+        m_state.store(AV_STOPPED);
     }
 }
 
-AVPlayer::PlayState AVPlayer::getState()
+void AVPlayer::closeAudioDevice()
 {
-    AVPlayer::PlayState state;
-    switch (SDL_GetAudioStatus())
-    {
-    case SDL_AUDIO_PLAYING:
-        state = AVPlayer::AV_PLAYING;
-        break;
-    case SDL_AUDIO_PAUSED:
-        state = AVPlayer::AV_PAUSED;
-        break;
-    case SDL_AUDIO_STOPPED:
-        state = AVPlayer::AV_STOPPED;
-        break;
-    default:
-        state = AVPlayer::AV_NONE;
-        break;
-    }
-    return state;
+    if(m_deviceFreq == 0) return;
+    SDL_CloseAudio();
+    m_deviceFreq = 0;
+    m_deviceChannels = 0;
 }
 
 void AVPlayer::handlePauseClick(bool isPause)
@@ -99,96 +135,345 @@ void AVPlayer::handlePauseClick(bool isPause)
     if(state == AV_STOPPED) return;
     if(isPause){
         if(state == AV_PLAYING){
+            // 录制中的直播暂停时跳到当前位置, 之后从录制中读取, 直播输入不再受播放阻塞
+            double start = 0.0, end = 0.0;
+            if(m_audioDecoder.load()->timeshiftRange(&start, &end)){
+                seekTo(m_audioClock.getClock() - m_audioDecoder.load()->startTime());
+            }
             SDL_PauseAudio(1);
-            m_pause = true;
+            m_state.store(AV_PAUSED);
+            {
+                std::lock_guard<std::mutex> lock(m_pauseMutex);
+                m_pause = true;
+            }
             m_pauseTime = av_gettime_relative() / 1000000.0;
         }
     }else{
         if(state == AV_PAUSED){
             SDL_PauseAudio(0);
-            m_pause = false;
+            m_state.store(AV_PLAYING);
+            {
+                std::lock_guard<std::mutex> lock(m_pauseMutex);
+                m_pause = false;
+            }
+            m_pauseCond.notify_all();
             m_frameTimer += av_gettime_relative() / 1000000.0 - m_pauseTime;
         }
     }
 }
 
-void AVPlayer::seekTo(int32_t time_s)
+void AVPlayer::setTimeshift(bool enable)
+{
+    m_decoder->setTimeshift(enable);
+    m_nextDecoder->setTimeshift(enable);
+}
+
+void AVPlayer::setVideoPresenter(VideoPresenter *presenter)
+{
+    VideoPresenter *old = m_presenter.exchange(presenter);
+    if(old && old != presenter){
+        old->setPresentCallback(nullptr);
+    }
+    if(presenter){
+        // 在渲染线程中回调, 视频时钟从帧真正出现在屏幕上的时刻开始走
+        presenter->setPresentCallback([this](double pts, double presentTime){
+            m_videoClock.setClockAt(pts, presentTime);
+        });
+    }
+}
+
+void AVPlayer::seekTo(double time_s, Decoder::SeekMode mode)
 {
     if(time_s < 0) time_s = 0;
-    m_decoder->seekTo(time_s);
+    if(VideoPresenter *presenter = m_presenter.load()){
+        presenter->flushFrames(); // 跳转前的帧不再显示
+    }
+    m_seekPendingTarget.store(time_s);
+    m_seekPending.store(true);
+    // 切换过程中音频已在播放下一项时, 跳转作用于下一项
+    m_audioDecoder.load()->seekTo(time_s, mode);
+    {
+        std::lock_guard<std::mutex> lock(m_pauseMutex);
+    }
+    m_pauseCond.notify_all(); // 视频线程可能在已播完的最后一帧上等待
 }
-void AVPlayer::seekBy(int32_t time_s)
+void AVPlayer::seekBy(int32_t time_s, Decoder::SeekMode mode)
+{
+    double base = m_seekPending.load() ? m_seekPendingTarget.load()
+                                       : m_audioClock.getClock() - m_audioDecoder.load()->startTime();
+    seekTo(base + time_s, mode);
+}
+
+AVPlayer::SeekStats AVPlayer::seekStats()
 {
-    seekTo((int32_t)m_audioClock.getClock() + time_s);
+    std::lock_guard<std::mutex> lock(m_statsMutex);
+    return m_seekStats;
+}
+
+void AVPlayer::recordSeekLatency(int serial)
+{
+    if(serial == m_lastVideoSerial) return;
+    m_lastVideoSerial = serial;
+    Decoder *decoder = m_videoDecoder.load();
+    int64_t requestTime = decoder->videoSeekRequestTime();
+    if(requestTime <= 0) return;
+    double ms = (av_gettime_relative() - requestTime) / 1000.0;
+    {
+        std::lock_guard<std::mutex> lock(m_statsMutex);
+        m_seekStats.count++;
+        m_seekStats.lastMs = ms;
+        m_seekStats.maxMs = FFMAX(m_seekStats.maxMs, ms);
+        m_seekStats.totalMs += ms;
+    }
+    if(decoder->videoPktSerial() == serial){
+        m_seekPending.store(false);
+    }
+    QLOG_INFO() << "seek to first frame:" << ms << "ms";
 }
 
 bool AVPlayer::play(const QString& url)
+{
+    setPlaylist(QStringList() << url);
+    return playIndex(0);
+}
+
+void AVPlayer::setPlaylist(const QStringList& urls, bool loop)
+{
+    m_playlist = urls;
+    m_playlistLoop = loop;
+}
+
+bool AVPlayer::playIndex(int index)
+{
+    if(index < 0 || index >= m_playlist.size()){
+        QLOG_ERROR() << "playlist index out of range" << index;
+        return false;
+    }
+    if(!openItem(m_playlist.at(index))) return false;
+    m_playlistIndex = index;
+    emit currentIndexChanged(index);
+    preloadNext();
+    return true;
+}
+
+void AVPlayer::preloadNext()
+{
+    // 从下一项开始找第一个能打开的, 打开失败的项被跳过
+    QStringList urls;
+    QList<int> indexes;
+    int count = m_playlist.size();
+    for(int i = 1; i <= count; i++){
+        int index = m_playlistIndex + i;
+        if(index >= count){
+            if(!m_playlistLoop) break;
+            index %= count;
+        }
+        indexes << index;
+        urls << m_playlist.at(index);
+    }
+    if(urls.isEmpty()) return;
+
+    m_preloadThreads.joinAll();
+    m_nextReady.store(false);
+    m_nextPending.store(true);
+    Decoder *decoder = m_nextDecoder;
+    m_preloadThreads.start("preload", [this, decoder, urls, indexes](){
+        bool ok = false;
+        for(int i = 0; i < urls.size() && !m_exit; i++){
+            int64_t start = av_gettime_relative();
+            ok = decoder->open(urls.at(i)) && decoder->start();
+            if(ok){
+                m_nextIndex = indexes.at(i);
+                QLOG_INFO() << "next item preloaded in" << (av_gettime_relative() - start) / 1000.0 << "ms:" << urls.at(i);
+                break;
+            }
+            decoder->exit();
+            QLOG_ERROR() << "preload fail, skip" << urls.at(i);
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_pauseMutex);
+            m_nextReady.store(ok);
+            m_nextPending.store(false);
+        }
+        m_pauseCond.notify_all();
+    });
+}
+
+Decoder *AVPlayer::takeNextDecoder(Decoder *current)
+{
+    std::lock_guard<std::mutex> lock(m_handoverMutex);
+    if(!m_nextReady.load() || m_nextDecoder == current) return nullptr;
+    return m_nextDecoder;
+}
+
+void AVPlayer::finishHandover()
+{
+    Decoder *old = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(m_handoverMutex);
+        if(!m_nextReady.load() || m_audioDecoder.load() != m_nextDecoder || m_videoDecoder.load() != m_nextDecoder){
+            return; // 另一条流水线还在播放上一项
+        }
+        old = m_decoder;
+        m_decoder = m_nextDecoder;
+        m_nextDecoder = old;
+        m_nextReady.store(false);
+    }
+    m_preloadThreads.joinAll();
+    old->exit();
+
+    m_playlistIndex = m_nextIndex;
+    m_duration = m_decoder->duraiton();
+    emit durationChanged(m_duration);
+    emit currentIndexChanged(m_playlistIndex);
+    QLOG_INFO() << "playlist switched to" << m_playlistIndex;
+    preloadNext();
+}
+
+bool AVPlayer::openItem(const QString& url)
 {
     QFileInfo fileInfo(url);
     QString suffix = fileInfo.suffix().toLower();
-    if(suffix != "mp4" && suffix != "mp3"){
+    // 网络地址的格式由探测决定, 本地文件仍按后缀检查
+    if(!HttpSource::isHttpUrl(url) && !Decoder::isLiveUrl(url) &&
+            suffix != "mp4" && suffix != "mp3" && suffix != "flv" && suffix != "ts"){
         MsgBox::error(nullptr, QString("文件无效, 不支持当前格式"));
         QLOG_ERROR() << "文件格式不正确";
         return false;
     }
     initPlayer(); //复用
-    if(!m_decoder->decode(url)){
+    m_playStartTime = av_gettime_relative();
+    StartupStats stats;
+
+    // 首次播放时SDL音频子系统初始化与探测流信息并行
+    std::future<bool> sdlInit;
+    if(!SDL_WasInit(SDL_INIT_AUDIO)){
+        sdlInit = ThreadPool::instance().commitTask([](){
+            return SDL_Init(SDL_INIT_AUDIO) == 0;
+        });
+    }
+    bool opened = m_decoder->open(url);
+    bool sdlReady = sdlInit.valid() ? sdlInit.get() : (SDL_WasInit(SDL_INIT_AUDIO) || SDL_Init(SDL_INIT_AUDIO) == 0);
+    stats.openMs = (av_gettime_relative() - m_playStartTime) / 1000.0;
+    if(!opened){
+        m_decoder->exit();
         MsgBox::error(nullptr, QString("文件解析失败"));
         QLOG_ERROR() << "文件解析失败";
         return false;
     }
+    if(!sdlReady){
+        m_decoder->exit();
+        QLOG_ERROR() << "sdl init audio fail";
+        return false;
+    }
 
     m_duration = m_decoder->duraiton();
     emit durationChanged(m_duration);
 
     m_pause = false;
     m_clockInitFlag = false;
-
+    m_seekPending.store(false);
+    m_lastVideoSerial = 0;
+    m_audioClockSerial.store(-1);
+    m_audioClockDecoder.store(nullptr);
+    m_audioDecoder.store(m_decoder);
+    m_videoDecoder.store(m_decoder);
+    m_syncPending = false;
+    m_firstFramePending.store(true);
+
+    // 解码器仍在线程池中打开, 同时打开音频设备和准备视频缓冲
+    int64_t start = av_gettime_relative();
     if(!initSDL()){
+        m_decoder->exit();
         QLOG_ERROR() << "init SDL fail";
         return false;
     }
-
+    m_state.store(AV_PAUSED); // 之后失败时由initPlayer()按正常流程停止
+    stats.audioOpenMs = (av_gettime_relative() - start) / 1000.0;
     initVideo();
+
+    start = av_gettime_relative();
+    if(!m_decoder->start()){
+        initPlayer(); // 音频设备已打开, 按正常流程停止
+        MsgBox::error(nullptr, QString("文件解析失败"));
+        QLOG_ERROR() << "open codec fail";
+        return false;
+    }
+    stats.codecWaitMs = (av_gettime_relative() - start) / 1000.0;
+    {
+        std::lock_guard<std::mutex> lock(m_statsMutex);
+        m_startupStats = stats;
+    }
+    SDL_PauseAudio(0);
+    m_state.store(AV_PLAYING);
     return true;
 }
 
+AVPlayer::StartupStats AVPlayer::startupStats()
+{
+    std::lock_guard<std::mutex> lock(m_statsMutex);
+    return m_startupStats;
+}
 
-bool AVPlayer::initSDL()
+void AVPlayer::recordFirstFrame()
 {
-    if(SDL_Init(SDL_INIT_AUDIO) != 0){
-        QLOG_ERROR() << "sdl init audio fail";
-        return false;
+    if(!m_firstFramePending.exchange(false)) return;
+    double ms = (av_gettime_relative() - m_playStartTime) / 1000.0;
+    StartupStats stats;
+    {
+        std::lock_guard<std::mutex> lock(m_statsMutex);
+        m_startupStats.firstFrameMs = ms;
+        stats = m_startupStats;
     }
+    QLOG_INFO() << "time to first frame:" << ms << "ms (open:" << stats.openMs
+                << "ms, audio device:" << stats.audioOpenMs << "ms, codec wait:" << stats.codecWaitMs << "ms)";
+}
+
+
+void AVPlayer::logLiveDrops()
+{
+    int drops = m_liveDropFrames.exchange(0);
+    if(drops > 0){
+        QLOG_INFO() << "live latency over" << LIVE_DROP_LATENCY << "s, dropped" << drops << "audio frames";
+    }
+}
+
+bool AVPlayer::initSDL() // SDL_Init已在play()中完成, 设备保持暂停, 解码器启动后再开始播放
+{
     m_exit = false;
     m_audioBufSize = 0;
     m_audioBufIndex = 0;
     m_lastAudioPts = -1;
     m_audioCodecPar = m_decoder->auidoCodecPar();
 
-    SDL_AudioSpec audioSpec;
-    audioSpec.channels = m_audioCodecPar->ch_layout.nb_channels; // 音频通道数
-    audioSpec.freq = m_audioCodecPar->sample_rate; // 采样率(44100
-    audioSpec.format = AUDIO_S16SYS; // 音频格式, (16bits
-    audioSpec.silence = 0; // 静音为0
-    audioSpec.userdata = this; // 用户数据
-    audioSpec.samples = m_audioCodecPar->frame_size; // 每个音频帧的样本数量(1024
-    audioSpec.callback = fillAudioStreamCallback;
-
-    if(SDL_OpenAudio(&audioSpec, nullptr) < 0){
-        QLOG_ERROR() << "SDL_OpenAudio fail";
-        return false;
+    // 输出格式不变时沿用已打开的设备; 每次回调的样本数只影响缓冲大小, 不需要重新打开
+    int freq = m_audioCodecPar->sample_rate;
+    int channels = m_audioCodecPar->ch_layout.nb_channels;
+    if(freq != m_deviceFreq || channels != m_deviceChannels){
+        closeAudioDevice();
+        SDL_AudioSpec audioSpec;
+        audioSpec.channels = channels; // 音频通道数
+        audioSpec.freq = freq; // 采样率(44100
+        audioSpec.format = AUDIO_S16SYS; // 音频格式, (16bits
+        audioSpec.silence = 0; // 静音为0
+        audioSpec.userdata = this; // 用户数据
+        audioSpec.samples = m_audioCodecPar->frame_size; // 每个音频帧的样本数量(1024
+        audioSpec.callback = fillAudioStreamCallback;
+
+        if(SDL_OpenAudio(&audioSpec, nullptr) < 0){
+            QLOG_ERROR() << "SDL_OpenAudio fail";
+            return false;
+        }
+        m_deviceFreq = freq;
+        m_deviceChannels = channels;
+        QLOG_INFO() << "audio device opened:" << freq << "Hz," << channels << "channels";
     }
 
-    m_fmtCtx = m_decoder->formatContext();
-    m_audioIndex = m_decoder->audioIndex();
     m_targetSampleFmt = AV_SAMPLE_FMT_S16; //16bits 位深
     m_targetChannels = m_audioCodecPar->ch_layout.nb_channels;
     m_targetFreq = m_audioCodecPar->sample_rate;
     m_targetNbSamples = m_audioCodecPar->frame_size; // 每个音频帧的数量(1024
     av_channel_layout_default(&m_targetChannelLayout, m_targetChannels);
-
-    SDL_PauseAudio(0);
     return true;
 }
 
@@ -199,15 +484,27 @@ void AVPlayer::fillAudioStreamCallback(void *userData, uint8_t *stream, int len)
     memset(stream, 0, len);
     AVPlayer *player = (AVPlayer*)userData;
     double audioPts = 0.00;
+    int audioSerial = -1; // 本次回调取到新帧时有效
+    Decoder *decoder = player->m_audioDecoder.load();
 
     while(len > 0){
         if(player->m_exit) break;
         if(player->m_audioBufIndex >= player->m_audioBufSize){
-            int ret = player->m_decoder->getAFrame(player->m_audioFrame);
+            int ret = decoder->getAFrame(player->m_audioFrame, &audioSerial);
             if(ret)
             {
                 player->m_audioBufIndex = 0;
-                if((player->m_targetSampleFmt != player->m_audioFrame->format ||
+                // 下个音频播放的时间
+                AVFormatContext *fmtCtx = decoder->formatContext();
+                audioPts = player->m_audioFrame->pts * av_q2d(fmtCtx->streams[decoder->audioIndex()]->time_base);
+                // 直播: 已读到但还没播放的时长, 超出目标时追赶, 远超时直接丢弃
+                double latency = decoder->isLive() ? decoder->audioReadPts() - audioPts : 0.0;
+                if(latency > LIVE_DROP_LATENCY){
+                    player->m_liveDropFrames.fetch_add(1, std::memory_order_relaxed);
+                    av_frame_unref(player->m_audioFrame);
+                    continue;
+                }
+                if((decoder->isLive() || player->m_targetSampleFmt != player->m_audioFrame->format ||
                         player->m_targetFreq != player->m_audioFrame->sample_rate ||
                         player->m_targetNbSamples != player->m_audioFrame->nb_samples
                         ||!AVPlayer::compareChannelLayouts(&player->m_targetChannelLayout, &player->m_audioFrame->ch_layout)
@@ -227,8 +524,10 @@ void AVPlayer::fillAudioStreamCallback(void *userData, uint8_t *stream, int len)
                     //// data[0]代表某个(左)声道的信息
                     const uint8_t **datas = (const uint8_t**)player->m_audioFrame->extended_data;
                     // 每个通道期望的样本数量(1024) +256提供足够空间
-                    int outSampleCount = (uint64_t)player->m_audioFrame->nb_samples *
-                            (player->m_targetFreq / player->m_audioFrame->sample_rate) + 128;
+                    // 切换到采样率不同的下一项时也要走这里, 不能用整数相除
+                    int outSampleCount = (int)av_rescale_rnd(swr_get_delay(player->m_swrCtx, player->m_audioFrame->sample_rate) +
+                                                             player->m_audioFrame->nb_samples, player->m_targetFreq,
+                                                             player->m_audioFrame->sample_rate, AV_ROUND_UP) + 128;
                     // 缓冲区所需要的大小, 返回单位为字节
                     int outSize = av_samples_get_buffer_size(nullptr,
                                                              player->m_targetChannelLayout.nb_channels,
@@ -237,6 +536,13 @@ void AVPlayer::fillAudioStreamCallback(void *userData, uint8_t *stream, int len)
                         QLOG_ERROR() << "av_samples_get_buffer_size fail";
                         return;
                     }
+                    if(decoder->isLive()){
+                        // 在这一帧内少输出一部分样本, 即按 1+LIVE_CATCHUP_SPEED 倍速播放
+                        int frameSamples = (int)av_rescale(player->m_audioFrame->nb_samples, player->m_targetFreq,
+                                                           player->m_audioFrame->sample_rate);
+                        int delta = latency > LIVE_TARGET_LATENCY ? -(int)(frameSamples * LIVE_CATCHUP_SPEED) : 0;
+                        swr_set_compensation(player->m_swrCtx, delta, frameSamples);
+                    }
                     // @param 2: 跟踪, 分配成功后, 更新为分配的大小
                     // @param 3: mini size
                     av_fast_malloc(&player->m_audioBuf, &player->m_audioBufSize, outSize);
@@ -272,15 +578,26 @@ void AVPlayer::fillAudioStreamCallback(void *userData, uint8_t *stream, int len)
                     // 此处对标上述swrconvert中的分配m_audioBuf
                     memcpy(player->m_audioBuf, player->m_audioFrame->data[0], player->m_audioBufSize);
                 }
-                // 下个音频播放的时间
-                audioPts = player->m_audioFrame->pts * av_q2d(player->m_fmtCtx->streams[player->m_audioIndex]->time_base);
                 av_frame_unref(player->m_audioFrame);
             }
             else{
-                if(player->m_decoder->isExit()){
+                // 当前项的音频已全部取走, 下一项就绪时在同一次回调中接着填充, 不留空隙
+                Decoder *next = decoder->audioFinished() ? player->takeNextDecoder(decoder) : nullptr;
+                if(next){
+                    player->m_audioDecoder.store(next);
+                    decoder = next;
+                    audioSerial = -1; // 上一项的时间戳不再用于时钟
+                    if(player->m_swrCtx){
+                        swr_free(&player->m_swrCtx); // 下一项的格式可能不同, 按需重建
+                    }
+                    emit player->itemHandover();
+                    continue;
+                }
+                // 没有下一项(或全部打开失败)时才结束播放
+                if(decoder->isFinished() && !player->m_nextPending.load() && !player->m_nextReady.load()){
                     emit player->avTerminate();
                 }
-                return;
+                break;
             }
         }
         int tmpLen = player->m_audioBufSize - player->m_audioBufIndex; //剩余的空间
@@ -296,10 +613,21 @@ void AVPlayer::fillAudioStreamCallback(void *userData, uint8_t *stream, int len)
         player->m_audioBufIndex += tmpLen;
         stream += tmpLen;
     }
+    if(audioSerial < 0) return; // 只播放了上次剩余的数据, 时钟不变
     player->m_audioClock.setClock(audioPts);
+    bool clockChanged = player->m_audioClockSerial.exchange(audioSerial) != audioSerial;
+    clockChanged = player->m_audioClockDecoder.exchange(decoder) != decoder || clockChanged;
+    if(clockChanged){
+        // 只在打开/跳转/切换后的首次回调, 唤醒等待音频时钟的视频线程
+        {
+            std::lock_guard<std::mutex> lock(player->m_pauseMutex);
+        }
+        player->m_pauseCond.notify_all();
+    }
     //发送时间戳变化信号,因为进度以整数秒单位变化展示，
     //所以大于一秒才发送，避免过于频繁的信号槽通信消耗性能
-    uint32_t _pts = (uint32_t)audioPts;
+    // 进度条从0开始, 扣除首个时间戳
+    uint32_t _pts = (uint32_t)FFMAX(0.0, audioPts - decoder->startTime());
     if(_pts != player->m_lastAudioPts){
         emit player->avPtsChanged(_pts);
         _pts = player->m_lastAudioPts;
@@ -311,30 +639,40 @@ void AVPlayer::fillAudioStreamCallback(void *userData, uint8_t *stream, int len)
 void AVPlayer::initVideo()
 {
     m_frameTimer = 0.0;
-    m_videoCodecPar = m_decoder->videoCodecPar();
-    m_videoIndex = m_decoder->videoIndex();
+    m_dstPixFmt = AV_PIX_FMT_YUV420P;
+    m_swsFlag = SWS_BICUBIC;
+    initVideoOutput();
 
+    m_threads.start("videoRender", [this](){
+        this->videoCallback();
+    });
+}
+
+void AVPlayer::initVideoOutput() // 打开时在GUI线程, 切换到下一项时在视频线程中调用
+{
+    m_videoCodecPar = m_videoDecoder.load()->videoCodecPar();
+    // 源格式可能变化, 转换上下文在首帧时重建
+    if(m_swsCtx){
+        sws_freeContext(m_swsCtx);
+        m_swsCtx = nullptr;
+    }
+    int format = VideoFrame::isNativeFormat(m_videoCodecPar->format) ? m_videoCodecPar->format : m_dstPixFmt;
+    if(m_imageWidth == m_videoCodecPar->width && m_imageHeight == m_videoCodecPar->height && m_imageFormat == format){
+        return; // 尺寸和格式不变, 沿用纹理
+    }
     m_imageWidth = m_videoCodecPar->width;
     m_imageHeight = m_videoCodecPar->height;
+    m_imageFormat = format;
     m_aspectRatio = m_imageWidth != 0 && m_imageHeight != 0 ? static_cast<float>(m_imageWidth) / static_cast<float>(m_imageHeight) : 1.0f;
+    emit videoSizeChanged(m_imageWidth, m_imageHeight, m_imageFormat);
+}
 
-    m_dstPixFmt = AV_PIX_FMT_YUV422P;
-    m_swsFlag = SWS_BICUBIC;
-
-    int bufSize = av_image_get_buffer_size(m_dstPixFmt, m_imageWidth, m_imageHeight, 1);
-    //m_videoBuf = (uint8_t*)av_realloc(m_videoBuf, bufSize * sizeof(uint8_t));
-    m_videoBuf = (uint8_t*)av_malloc(bufSize * sizeof(uint8_t));
-    /**
-     * @brief av_image_fill_arrays 当前函数中用于初始化 m_pixels, m_pitch
-     * @param m_pixels 指向存储每个平面（如 YUV 图像的 Y、U、V 分量）的数据指针的数组
-     * @param m_pitch 指向每个平面的行大小（以字节为单位）的数组
-     * @param m_videoBuf 传入的图像数据
-     */
-    av_image_fill_arrays(m_pixels, m_pitch, m_videoBuf, m_dstPixFmt, m_imageWidth, m_imageHeight, 1);
-
-    ThreadPool::instance().commitTask([this](){
-        this->videoCallback();
-    });
+void AVPlayer::switchVideoDecoder(Decoder *next)
+{
+    m_videoDecoder.store(next);
+    initVideoOutput();
+    m_lastVideoSerial = -1; // 下一项的首帧立即显示, 上一项的最后一帧保留到此时
+    emit itemHandover();
 }
 
 void AVPlayer::videoCallback()
@@ -345,32 +683,63 @@ void AVPlayer::videoCallback()
     if(m_clockInitFlag == false){
         initAVClock();
     }
+    Decoder *decoder = m_videoDecoder.load();
 
     do
     {
         if(m_exit) break;
         if(m_pause){
-            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            // 暂停期间阻塞, 直到继续播放或退出
+            std::unique_lock<std::mutex> lock(m_pauseMutex);
+            m_pauseCond.wait(lock, [this](){return !m_pause || m_exit;});
             continue;
         }
 
-        if(m_decoder->getRemainingVFrameSize()){
-            Decoder::FFrame *lastFrame = m_decoder->getLastVFrame();
-            Decoder::FFrame *curFrame = m_decoder->getVFrame();
+        if(decoder->getRemainingVFrameSize()){
+            Decoder::FFrame *lastFrame = decoder->getLastVFrame();
+            Decoder::FFrame *curFrame = decoder->getVFrame();
+            if(!curFrame) break;
 
-            if(curFrame->serial != m_decoder->videoPktSerial()){
-                m_decoder->setNextVFrame();
+            if(curFrame->serial != decoder->videoPktSerial()){
+                decoder->setNextVFrame();
                 continue;
             }
-            if(curFrame->serial != lastFrame->serial){
-                m_frameTimer = av_gettime_relative() / 1000000.0;
+            time = av_gettime_relative() / 1000000.0;
+            // 打开或跳转后的首帧不等待同步, 解码出来立即显示
+            if(m_firstFramePending.load() || curFrame->serial != m_lastVideoSerial){
+                disPlayImage(&curFrame->frame, time);
+                recordFirstFrame();
+                recordSeekLatency(curFrame->serial);
+                decoder->setNextVFrame();
+                m_frameTimer = time;
+                m_syncPending = true;
+                continue;
+            }
+            // 保持首帧直到音频时钟跟上, 再从当前时刻开始按同步节奏播放, 避免画面跳动
+            if(m_syncPending){
+                bool audioReady = m_audioClockDecoder.load() == decoder && m_audioClockSerial.load() == curFrame->serial;
+                if(!audioReady && time - m_frameTimer < AV_FIRST_FRAME_AUDIO_WAIT){
+                    // 由音频回调在时钟序号变化时唤醒, 跳转/暂停/退出也会唤醒
+                    int serial = curFrame->serial;
+                    auto timeout = std::chrono::microseconds((int64_t)((m_frameTimer + AV_FIRST_FRAME_AUDIO_WAIT - time) * 1000000));
+                    std::unique_lock<std::mutex> lock(m_pauseMutex);
+                    m_pauseCond.wait_for(lock, timeout, [this, decoder, serial](){
+                        return m_exit || m_pause || decoder->videoPktSerial() != serial ||
+                                (m_audioClockDecoder.load() == decoder && m_audioClockSerial.load() == serial);
+                    });
+                    continue;
+                }
+                m_syncPending = false;
+                m_frameTimer = time;
             }
             duration = frameDuration(lastFrame, curFrame);
             delay = computeTargetDelay(duration);
             time = av_gettime_relative() / 1000000.0;
 
-            if(time < m_frameTimer + delay){ // 没有到显示时间
-                QThread::msleep((uint32_t)(FFMIN(AV_SYNC_REJUDGESHOLD, m_frameTimer + delay - time)*1000));
+            // 独立渲染线程由垂直同步决定显示时刻, 提前提交以免错过期望的那次垂直同步
+            double ahead = m_presenter.load() ? RENDER_SUBMIT_AHEAD : 0.0;
+            if(time < m_frameTimer + delay - ahead){ // 没有到显示时间
+                QThread::msleep((uint32_t)(FFMIN(AV_SYNC_REJUDGESHOLD, m_frameTimer + delay - ahead - time)*1000));
                 continue;
             }
             m_frameTimer += delay;
@@ -378,62 +747,96 @@ void AVPlayer::videoCallback()
                 m_frameTimer = time; // 当前帧显示时间抓紧到现在
             }
             // 判断是否进行丢帧处理
-            if(m_decoder->getRemainingVFrameSize() > 1){
-                Decoder::FFrame *nextFrame = m_decoder->getNextVFrame();
+            if(decoder->getRemainingVFrameSize() > 1){
+                Decoder::FFrame *nextFrame = decoder->getNextVFrame();
                 duration = nextFrame->pts - curFrame->pts;
                 // 当前时间已经过了下一帧展现结束的时间
                 if(time > m_frameTimer + duration){
-                    m_decoder->setNextVFrame();
+                    decoder->setNextVFrame();
                     QLOG_INFO() << "abandon vFrame";
                     continue;
                 }
             }
-            disPlayImage(&curFrame->frame);
-            m_decoder->setNextVFrame();
+            disPlayImage(&curFrame->frame, m_frameTimer);
+            decoder->setNextVFrame();
+            if(time - m_liveDropLogTime >= LIVE_DROP_LOG_INTERVAL){
+                m_liveDropLogTime = time;
+                logLiveDrops();
+            }
         }
         else{
-            QThread::msleep(10);
+            // 阻塞到解码线程推入新帧, 解码器退出时结束
+            if(decoder->waitVFrame()) continue;
+            if(m_exit || decoder->isExit()) break;
+            // 当前项已播完, 切换到下一项, 画面停在最后一帧直到下一项首帧
+            Decoder *next = takeNextDecoder(decoder);
+            if(next){
+                switchVideoDecoder(next);
+                decoder = next;
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(m_pauseMutex);
+            m_pauseCond.wait(lock, [this, decoder](){
+                return m_exit || m_nextReady.load() || !decoder->videoFinished();
+            });
         }
     }while(true);
 }
 
 
-void AVPlayer::disPlayImage(AVFrame *frame)
+void AVPlayer::disPlayImage(AVFrame *frame, double targetTime)
 {
     if(!frame) return;
-    if((m_videoCodecPar->width != m_imageWidth ||
-        m_videoCodecPar->height != m_imageHeight ||
-        m_videoCodecPar->format != m_dstPixFmt) &&!m_swsCtx)
-    {
+    QSharedPointer<VideoFrame> image;
+    if(VideoFrame::isNativeFormat(frame->format)){
+        // 由着色器完成色度上采样和位深转换, 直接引用解码器的缓冲
+        image = QSharedPointer<VideoFrame>::create(frame);
+    }
+    else{
         /** @brief get m_swsCtx
          * @param m_swsFlag 缩放的标志 SWS_BICUBIC ...
          * @param frame... 源数据
          * @param m_... 目标图像
          */
         m_swsCtx = sws_getCachedContext(m_swsCtx, frame->width, frame->height,(AVPixelFormat)frame->format
-                        ,m_imageWidth, m_imageHeight, m_dstPixFmt, m_swsFlag, nullptr, nullptr, nullptr);
+                        ,frame->width, frame->height, m_dstPixFmt, m_swsFlag, nullptr, nullptr, nullptr);
+        // 渲染端可能还持有上一帧, 每帧转换到新的缓冲中, 缓冲从池中取出, 渲染端释放后归还
+        AVFrame *dst = av_frame_alloc();
+        if(m_swsCtx && dst){
+            dst->format = m_dstPixFmt;
+            dst->width = frame->width;
+            dst->height = frame->height;
+        }
+        if(!m_swsCtx || !dst || !FrameBufferPool::instance().getBuffer(dst)){
+            QLOG_ERROR() << "prepare video frame conversion fail";
+        }
+        else{
+            /**
+             * @brief 进行格式转换
+             * @param frame->data 指向源图像数据的指针数组，通常是一个包含每个图像平面的指针的数组（如 YUV 图像）
+             * @param linesize 图像的步幅（每行字节数）数组，通常与源图像的每个平面对应
+             * @param 0 处理的源图像的起始行（Y 坐标）
+             * @param srcSliceH: 指定要处理的源图像的高度（以行数为单位）。
+             * @param dst: 指向目标图像数据的指针数组，通常也是一个包含每个图像平面的指针的数组。
+             * @param dstStride: 目标图像的步幅数组，与目标图像的每个平面对应
+             */
+            sws_scale(m_swsCtx, static_cast<const uint8_t* const*>(frame->data),
+                      frame->linesize, 0, frame->height, dst->data, dst->linesize);
+            image = QSharedPointer<VideoFrame>::create(dst);
+        }
+        av_frame_free(&dst);
     }
-    if(m_swsCtx){
-        /**
-         * @brief 进行格式转换
-         * @param frame->data 指向源图像数据的指针数组，通常是一个包含每个图像平面的指针的数组（如 YUV 图像）
-         * @param linesize 图像的步幅（每行字节数）数组，通常与源图像的每个平面对应
-         * @param 0 处理的源图像的起始行（Y 坐标）
-         * @param srcSliceH: 指定要处理的源图像的高度（以行数为单位）。
-         * @param dst: 指向目标图像数据的指针数组，通常也是一个包含每个图像平面的指针的数组。
-         * @param dstStride: 目标图像的步幅数组，与目标图像的每个平面对应
-         */
-        sws_scale(m_swsCtx, static_cast<const uint8_t* const*>(frame->data),
-                  frame->linesize, 0, frame->height, m_pixels, m_pitch);
-
-//        QSharedPointer<YUV422Frame> av_frame = QSharedPointer<YUV422Frame>::create(m_pixels[0], m_imageWidth, m_imageHeight);
-//        emit frameChanged(av_frame);
-        emit frameChanged(QSharedPointer<YUV422Frame>::create(m_pixels[0], m_imageWidth, m_imageHeight));
+    Decoder *decoder = m_videoDecoder.load();
+    double pts = frame->pts * av_q2d(decoder->formatContext()->streams[decoder->videoIndex()]->time_base);
+    VideoPresenter *presenter = m_presenter.load();
+    if(presenter && image && image->isValid()){
+        presenter->submitFrame(image, pts, targetTime); // 显示后回调更新视频时钟
+        return;
     }
-    else{
-        QLOG_ERROR() << "sws_getChachedContext fail";
+    if(image && image->isValid()){
+        emit frameChanged(image);
     }
-    m_videoClock.setClock(frame->pts * av_q2d(m_fmtCtx->streams[m_videoIndex]->time_base));
+    m_videoClock.setClock(pts);
 }
 
 void AVPlayer::initAVClock()
@@ -461,6 +864,9 @@ double AVPlayer::frameDuration(Decoder::FFrame *lastFrame, Decoder::FFrame *curr
 
 double AVPlayer::computeTargetDelay(double delay) // 传入的是两帧的时间间隔
 {
+    if(m_audioClockDecoder.load() != m_videoDecoder.load() || m_audioClockSerial.load() != m_lastVideoSerial){
+        return delay; // 音频时钟还停在跳转之前或上一项, 视频按自身节奏播放
+    }
     double diff = m_videoClock.getClock() - m_audioClock.getClock();
     // 当 min < delay < max时赋值于 sync
     double sync = FFMAX(AV_SYNC_THRESHOLD_MIN, FFMIN(AV_SYNC_THRESHOLD_MAX, delay));
@@ -1,7 +1,11 @@
 #ifndef AVPLAYER_H
 #define AVPLAYER_H
 #include <QObject>
+#include <QStringList>
+#include <mutex>
+#include <condition_variable>
 #include "Decoder.h"
+#include "PipelineThreads.h"
 
 extern "C"{
 #include <SDL.h>
@@ -24,9 +28,21 @@ extern "C"{
 #define AV_NOSYNC_THRESHOLD 10.0
 
 #define AV_SYNC_REJUDGESHOLD 0.01
+//打开/跳转后首帧立即显示, 之后最多等待音频该时长(秒)再开始同步播放
+#define AV_FIRST_FRAME_AUDIO_WAIT 0.5
+// 直播: 已读到未播放的音频超过目标延迟(秒)时按该比例加速播放,
+// 超过丢弃阈值时直接丢弃音频帧, 视频跟随音频时钟丢帧
+#define LIVE_TARGET_LATENCY 0.08
+#define LIVE_CATCHUP_SPEED 0.05
+#define LIVE_DROP_LATENCY 0.5
+// 直播丢弃音频帧的汇总日志间隔(秒)
+#define LIVE_DROP_LOG_INTERVAL 5.0
+// 独立渲染线程模式下提前提交帧的时长(秒), 由渲染线程对齐到垂直同步
+#define RENDER_SUBMIT_AHEAD 0.05
 
 
-class YUV422Frame;
+class VideoFrame;
+class VideoPresenter;
 
 class AVClock
 {
@@ -42,18 +58,19 @@ public:
     }
     inline void setClock(double pts)
     {
-        setClockAt(pts);
+        setClockAt(pts, av_gettime_relative() / 1000000.0);
+    }
+    // pts在time时刻(av_gettime_relative的秒数)生效, 例如帧实际显示的时刻
+    inline void setClockAt(double pts, double time)
+    {
+        m_drift = pts - time;
+        m_pts = pts;
     }
     inline double getClock()
     {
         return m_drift + av_gettime_relative() / 1000000.0;
     }
 private:
-    inline void setClockAt(double pts)
-    {
-        m_drift = pts - av_gettime_relative() / 1000000.0;
-        m_pts = pts;
-    }
 
     double m_pts;
     double m_drift;
@@ -67,8 +84,21 @@ class AVPlayer : public QObject
 public:
     explicit AVPlayer(QObject *parent = nullptr);
     ~AVPlayer();
+    // 播放单个文件, 等同于只有一项的播放列表
     bool play(const QString& url);
+    // 设置播放列表, 调用playIndex()后生效; loop为true时播完最后一项回到第一项
+    void setPlaylist(const QStringList& urls, bool loop = false);
+    // 从第index项开始播放, 播放期间在后台预先打开下一项, 播完后无缝切换
+    bool playIndex(int index);
+    inline int currentIndex() const {return m_playlistIndex;}
     void handlePauseClick(bool isPause);
+    // 直播时移: 边播放边录制到本地, 暂停后从暂停处继续, 也可以跳回已录制的范围, 下次play()生效
+    void setTimeshift(bool enable);
+    /**
+     * @brief 使用独立渲染线程显示视频, 可在播放中设置, nullptr恢复为frameChanged信号
+     * 帧提前RENDER_SUBMIT_AHEAD提交, 视频时钟按渲染线程回报的实际显示时刻更新
+     */
+    void setVideoPresenter(VideoPresenter *presenter);
     void initPlayer();
     static bool compareChannelLayouts(const AVChannelLayout *layout1, const AVChannelLayout *layout2);
 
@@ -83,40 +113,130 @@ public:
         AV_PAUSED,
         AV_NONE
     };
-    AVPlayer::PlayState getState();
+    // 音频设备在文件之间保持打开, 播放状态由播放器自己维护
+    inline AVPlayer::PlayState getState() const {return m_state.load();}
+
+    // FAST: 停在目标之前的关键帧, 适合拖动预览; EXACT: 精确到目标
+    // time_s可带小数, 例如时移暂停时按当前时钟精确跳转
+    void seekTo(double time_s, Decoder::SeekMode mode = Decoder::SEEK_EXACT);
+    void seekBy(int32_t time_s, Decoder::SeekMode mode = Decoder::SEEK_EXACT);
+
+    // 跳转响应统计: 从跳转请求到新位置首帧显示的耗时
+    struct SeekStats{
+        int count = 0;
+        double lastMs = 0.0;
+        double maxMs = 0.0;
+        double totalMs = 0.0;
+    };
+    SeekStats seekStats();
 
-    void seekTo(int32_t time_s);
-    void seekBy(int32_t time_s);
+    // 启动耗时, 每次play()更新
+    struct StartupStats{
+        double openMs = 0.0; // 打开文件及探测流信息
+        double audioOpenMs = 0.0; // 打开音频设备, 与解码器打开并行
+        double codecWaitMs = 0.0; // 等待解码器打开
+        double firstFrameMs = 0.0; // 从play()到首帧显示
+    };
+    StartupStats startupStats();
 
 private:
+    // 打开并开始播放一项, 原play()的流程
+    bool openItem(const QString& url);
+    // 在预加载线程中打开并启动下一项的解码器
+    void preloadNext();
+    // 下一项已就绪且不是current时返回它, 否则返回nullptr
+    Decoder *takeNextDecoder(Decoder *current);
+    // 视频线程切换到下一项
+    void switchVideoDecoder(Decoder *next);
+    // 打开音频设备, 输出格式与已打开的设备一致时直接复用
     bool initSDL();
+    void closeAudioDevice();
     void initVideo();
+    // 按当前视频流尺寸准备转换缓冲, 尺寸变化时通知渲染端
+    void initVideoOutput();
     void initAVClock();
     void videoCallback();
     double frameDuration(Decoder::FFrame *lastFrame, Decoder::FFrame *currentFrame);
     double computeTargetDelay(double delay);
-    void disPlayImage(AVFrame *frame);
+    // 视频线程显示一帧后调用, 新序号的首帧即一次跳转完成
+    void recordSeekLatency(int serial);
+    // 视频线程显示打开后的首帧时调用
+    void recordFirstFrame();
+    void logLiveDrops();
+    // 渲染端支持解码格式时直接引用解码帧, 否则转换到新分配的帧中, 再交给渲染端
+    // targetTime: 期望显示的时刻, 只有独立渲染线程使用
+    void disPlayImage(AVFrame *frame, double targetTime);
 
     static void fillAudioStreamCallback(void* userData, uint8_t *stream, int len);
 
+private slots:
+    // 音频和视频都切换到下一项后, 在GUI线程中释放上一项并预加载再下一项
+    void finishHandover();
+
 signals:
     void durationChanged(uint32_t duration);
     void avTerminate();
     void avPtsChanged(unsigned int pts);
-    void frameChanged(QSharedPointer<YUV422Frame> frame);
+    void frameChanged(QSharedPointer<VideoFrame> frame);
+    // 流信息就绪, 渲染端可以在首帧到达前按尺寸和像素格式准备纹理
+    void videoSizeChanged(int width, int height, int format);
+    // 播放列表切换到第index项
+    void currentIndexChanged(int index);
+    // 内部使用: 音频回调或视频线程切换到了下一项
+    void itemHandover();
 private:
-    Decoder *m_decoder;
+    Decoder *m_decoder; // 当前项
+    Decoder *m_nextDecoder; // 预加载的下一项
+    // 音频回调/视频线程各自正在使用的解码器, 切换时先后指向m_nextDecoder
+    std::atomic<Decoder*> m_audioDecoder;
+    std::atomic<Decoder*> m_videoDecoder;
+    // 音频时钟来自哪个解码器, 与视频解码器一致时才参与同步
+    std::atomic<Decoder*> m_audioClockDecoder;
+    std::mutex m_handoverMutex;
+    std::atomic_bool m_nextReady; // 下一项已打开并开始解码
+    std::atomic_bool m_nextPending; // 正在预加载下一项
+    PipelineThreads m_preloadThreads;
+    QStringList m_playlist;
+    int m_playlistIndex;
+    int m_nextIndex;
+    bool m_playlistLoop;
+    std::atomic<PlayState> m_state;
+    // 已打开的音频设备格式, 未打开时均为0
+    int m_deviceFreq;
+    int m_deviceChannels;
+    // 视频渲染线程
+    PipelineThreads m_threads;
     uint32_t m_duration;
     //音视频的暂停
     bool m_pause;
     // 记录上一次暂停的时间
     double m_pauseTime;
+    // 视频线程在暂停期间阻塞于此
+    std::mutex m_pauseMutex;
+    std::condition_variable m_pauseCond;
+
+    // 跳转尚未显示出首帧时, 连续快进/后退以未完成的目标为基准
+    std::atomic_bool m_seekPending;
+    std::atomic<double> m_seekPendingTarget;
+    int m_lastVideoSerial; // 上一次显示的帧序号, 仅视频线程访问
+    // 音频时钟对应的跳转序号, 与视频序号一致时才参与同步
+    std::atomic_int m_audioClockSerial;
+    // 直播延迟过大时音频回调丢弃的帧数, 回调中只计数, 由视频线程/停止时汇总输出
+    std::atomic_int m_liveDropFrames;
+    double m_liveDropLogTime; // 仅视频线程访问
+    // 首帧已显示, 等待音频时钟就绪, 仅视频线程访问
+    bool m_syncPending;
+    std::mutex m_statsMutex;
+    SeekStats m_seekStats;
+    StartupStats m_startupStats;
+    int64_t m_playStartTime;
+    std::atomic_bool m_firstFramePending;
     //同步时钟初始化标志, 音视频异步线程
     //谁先读到标志位, 谁先初始化时钟
     bool m_clockInitFlag;
 
-    // 音视频停止
-    bool m_exit;
+    // 音视频停止, 视频/预加载线程和音频回调都会读取
+    std::atomic_bool m_exit;
 
     // SDL buf
     uint8_t *m_audioBuf;
@@ -125,7 +245,6 @@ private:
     uint32_t m_lastAudioPts;
 
     AVCodecParameters *m_audioCodecPar;
-    AVFormatContext *m_fmtCtx;
 
     enum AVSampleFormat m_targetSampleFmt; //位深
     int m_targetChannels;
@@ -134,9 +253,6 @@ private:
     AVChannelLayout m_targetChannelLayout;
     int m_targetNbSamples;
 
-    int m_audioIndex;
-    int m_videoIndex;
-
     AVFrame *m_audioFrame;
     SwsContext *m_swsCtx;
     SwrContext *m_swrCtx;
@@ -150,19 +266,15 @@ private:
     AVCodecParameters *m_videoCodecPar;
     int m_imageWidth;
     int m_imageHeight;
+    int m_imageFormat; // 送往渲染端的像素格式
     float m_aspectRatio = 1; // 宽高比
+    // 独立渲染线程, 为空时通过frameChanged显示; 渲染线程启动后才设置, 视频线程可能正在读取
+    std::atomic<VideoPresenter*> m_presenter{nullptr};
 
-    enum AVPixelFormat m_dstPixFmt;
+    enum AVPixelFormat m_dstPixFmt; // 渲染端不支持解码格式时的转换目标
     int m_swsFlag;
     double m_delay; // delaytime
 
-    // 指向存储每个平面（如 YUV 图像的 Y、U、V 分量）的数据指针的数组
-    uint8_t* m_pixels[4];
-    // 指向每个平面的行大小（以字节为单位）的数组, 也可以称为步幅
-    int m_pitch[4];
-    // // 保存的是单个图片的数据
-    uint8_t *m_videoBuf;
-
 };
 
 #endif // AVPLAYER_H
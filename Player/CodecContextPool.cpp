@@ -0,0 +1,82 @@
+#include "CodecContextPool.h"
+#include <QsLog.h>
+#include <cstring>
+
+CodecContextPool::~CodecContextPool()
+{
+    clear();
+}
+
+AVCodecContext *CodecContextPool::acquire(const AVCodecParameters *par, int threadType, bool lowDelay, int maxThreads)
+{
+    if(lowDelay) threadType &= ~FF_THREAD_FRAME;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for(auto it = m_entries.begin(); it != m_entries.end(); ++it){
+        AVCodecContext *ctx = it->ctx;
+        if(ctx->thread_type != threadType) continue;
+        if(ctx->thread_count > maxThreads) continue;
+        if(((ctx->flags & AV_CODEC_FLAG_LOW_DELAY) != 0) != lowDelay) continue;
+        if(!sameParameters(it->par, par)) continue;
+        avcodec_parameters_free(&it->par);
+        m_entries.erase(it);
+        return ctx;
+    }
+    return nullptr;
+}
+
+void CodecContextPool::release(AVCodecContext *ctx, const AVCodecParameters *par)
+{
+    if(!ctx) return;
+    Entry entry{ctx, avcodec_parameters_alloc()};
+    if(!avcodec_is_open(ctx) || !entry.par || avcodec_parameters_copy(entry.par, par) < 0){
+        freeEntry(entry);
+        return;
+    }
+    // 在归还的线程上完成重置, 取出时可直接使用
+    avcodec_flush_buffers(ctx);
+    ctx->skip_frame = AVDISCARD_DEFAULT;
+    ctx->skip_loop_filter = AVDISCARD_DEFAULT;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries.push_back(entry);
+    while(m_entries.size() > CODEC_POOL_MAX){
+        freeEntry(m_entries.front());
+        m_entries.pop_front();
+    }
+}
+
+void CodecContextPool::clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for(Entry& entry : m_entries){
+        freeEntry(entry);
+    }
+    m_entries.clear();
+}
+
+bool CodecContextPool::sameParameters(const AVCodecParameters *a, const AVCodecParameters *b)
+{
+    if(a->codec_type != b->codec_type || a->codec_id != b->codec_id ||
+            a->codec_tag != b->codec_tag || a->format != b->format ||
+            a->profile != b->profile || a->level != b->level){
+        return false;
+    }
+    if(a->codec_type == AVMEDIA_TYPE_VIDEO &&
+            (a->width != b->width || a->height != b->height)){
+        return false;
+    }
+    if(a->codec_type == AVMEDIA_TYPE_AUDIO &&
+            (a->sample_rate != b->sample_rate || a->block_align != b->block_align ||
+             av_channel_layout_compare(&a->ch_layout, &b->ch_layout) != 0)){
+        return false;
+    }
+    // 解码器在打开时解析extradata(如avcC中的SPS/PPS), 必须完全一致
+    if(a->extradata_size != b->extradata_size) return false;
+    return a->extradata_size == 0 || memcmp(a->extradata, b->extradata, a->extradata_size) == 0;
+}
+
+void CodecContextPool::freeEntry(Entry &entry)
+{
+    avcodec_free_context(&entry.ctx);
+    avcodec_parameters_free(&entry.par);
+}
@@ -0,0 +1,57 @@
+#ifndef CODECCONTEXTPOOL_H
+#define CODECCONTEXTPOOL_H
+
+#include <deque>
+#include <mutex>
+#include "ThreadPool.h"
+
+extern "C"{
+#include <libavcodec/avcodec.h>
+}
+
+// 池中最多保留的已打开解码器数量
+#define CODEC_POOL_MAX 4
+
+/**
+ * @brief 已打开解码器的复用池
+ * Decoder释放时把解码器flush后放回池中, 下一个文件的流参数(编码, extradata,
+ * 尺寸/采样格式)与线程设置完全一致时直接取出, 省去avcodec_open2及解码线程的创建
+ * 参数不同的解码器不能在打开后重新设置参数, 仍需重新打开
+ */
+class CodecContextPool : public ForbidCopy
+{
+public:
+    static CodecContextPool& instance()
+    {
+        static CodecContextPool ins;
+        return ins;
+    }
+    ~CodecContextPool();
+
+    /**
+     * @brief 取出与参数一致的解码器
+     * @param threadType/lowDelay 与ThreadingPolicy对应, 需与打开时的设置一致
+     * @param maxThreads 线程数不超过该值的才能复用, 调用方还需向ThreadBudget领取到完整的thread_count
+     * @return 没有可复用的返回nullptr
+     */
+    AVCodecContext *acquire(const AVCodecParameters *par, int threadType, bool lowDelay, int maxThreads);
+    // 归还已打开的解码器, par为打开时使用的流参数; 池满时释放最早归还的
+    // 池中解码器的内部线程处于空闲, 不占ThreadBudget, 取出后重新领取
+    void release(AVCodecContext *ctx, const AVCodecParameters *par);
+    void clear();
+
+private:
+    CodecContextPool() = default;
+
+    struct Entry{
+        AVCodecContext *ctx;
+        AVCodecParameters *par; // 打开时的流参数副本
+    };
+    static bool sameParameters(const AVCodecParameters *a, const AVCodecParameters *b);
+    static void freeEntry(Entry& entry);
+
+    std::mutex m_mutex;
+    std::deque<Entry> m_entries;
+};
+
+#endif // CODECCONTEXTPOOL_H
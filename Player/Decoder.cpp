@@ -1,21 +1,65 @@
 #include "Decoder.h"
 #include "ThreadPool.h"
+#include "MemoryBudget.h"
+#include "ThreadBudget.h"
+#include "StreamInfoCache.h"
+#include "CodecContextPool.h"
 #include <QsLog.h>
+#include <QFileInfo>
+#include <QUrl>
+#include <cstring>
+
+extern "C"{
+#include <libavutil/time.h>
+}
 
 Decoder::Decoder()
     : m_exit(false),
+      m_finished(false),
+      m_eof(false),
       m_pAvFormatCtx(nullptr),
       m_duration(0),
+      m_startTime(0),
       m_videoIndex(-1),
       m_audioIndex(-1),
-      m_maxPktQueueSize(32),
-      m_maxFrameQueueSize(16)
+      m_maxPktQueueSize(1024),
+      m_maxFrameQueueSize(16),
+      m_maxPktQueueBytes(PKT_QUEUE_MAX_BYTES),
+      m_maxPktQueueDuration(PKT_QUEUE_MAX_DURATION * AV_TIME_BASE),
+      m_liveMode(false),
+      m_live(false),
+      m_audioReadPts(0),
+      m_seekMode(SEEK_EXACT),
+      m_seekSkipLoopFilter(false),
+      m_seekSerial(0),
+      m_lastKeyframePts(AV_NOPTS_VALUE),
+      m_ioOp(IO_NONE),
+      m_ioStart(0),
+      m_ioDeadline(0),
+      m_ioSeekSerial(0),
+      m_ioTimedOut(false),
+      m_openTimeout(IO_OPEN_TIMEOUT * AV_TIME_BASE),
+      m_readTimeout(IO_READ_TIMEOUT * AV_TIME_BASE),
+      m_mappedIoWindow(MAPPED_IO_WINDOW),
+      m_readAheadDepth(READ_AHEAD_DEPTH),
+      m_readAheadChunk(READ_AHEAD_CHUNK),
+      m_readAhead(nullptr),
+      m_httpSource(nullptr),
+      m_httpDiskCache(true),
+      m_probeSize(PROBE_SIZE_DEFAULT),
+      m_analyzeDuration(ANALYZE_DURATION_DEFAULT * AV_TIME_BASE),
+      m_streamInfoCache(true),
+      m_timeshift(false),
+      m_timeshiftWindow(TIMESHIFT_WINDOW * AV_TIME_BASE),
+      m_shifted(false),
+      m_shiftCtx(nullptr),
+      m_captureStop(false)
 {
     ThreadPool::instance();
-    m_audioPktQueue.pktVec.resize(m_maxPktQueueSize);
-    m_videoPktQueue.pktVec.resize(m_maxPktQueueSize);
-    m_audioFrameQueue.frameVec.resize(m_maxFrameQueueSize);
-    m_videoFrameQueue.frameVec.resize(m_maxFrameQueueSize);
+    m_audioPktQueue.ring.resize(m_maxPktQueueSize);
+    m_videoPktQueue.ring.resize(m_maxPktQueueSize);
+    m_audioFrameQueue.ring.resize(m_maxFrameQueueSize);
+    m_videoFrameQueue.ring.resize(m_maxFrameQueueSize);
     m_audioPktDecoder.codecCtx = nullptr;
     m_videoPktDecoder.codecCtx = nullptr;
     initVal();
@@ -28,139 +72,393 @@ Decoder::~Decoder()
 
 void Decoder::initVal()
 {
-    m_exit.store(false);
-    m_audioPktQueue.size = 0;
-    m_audioPktQueue.serial = 0;
-    m_audioPktQueue.pushIndex = 0;
-    m_audioPktQueue.readIndex = 0;
-    m_videoPktQueue.size = 0;
-    m_videoPktQueue.serial = 0;
-    m_videoPktQueue.pushIndex = 0;
-    m_videoPktQueue.readIndex = 0;
-
-    m_audioFrameQueue.size = 0;
+    m_finished.store(false);
+    m_eof.store(false);
+    m_audioReadPts.store(0);
+    m_audioPktQueue.serial.store(0);
+    m_audioPktQueue.bytes.store(0);
+    m_audioPktQueue.duration.store(0);
+    m_videoPktQueue.serial.store(0);
+    m_videoPktQueue.bytes.store(0);
+    m_videoPktQueue.duration.store(0);
+
     m_audioFrameQueue.shown = 0;
-    m_audioFrameQueue.pushIndex = 0;
-    m_audioFrameQueue.readIndex = 0;
-    m_videoFrameQueue.size = 0;
     m_videoFrameQueue.shown = 0;
-    m_videoFrameQueue.pushIndex = 0;
-    m_videoFrameQueue.readIndex = 0;
 
     m_audioPktDecoder.serial = 0;
     m_videoPktDecoder.serial = 0;
 
     m_isSeek = false;
-    m_audSeek = false;
-    m_vidSeek = false;
+    m_seekTarget.store(AV_NOPTS_VALUE);
+    m_seekRequestTime.store(0);
+    m_audioPktQueue.seekTarget.store(AV_NOPTS_VALUE);
+    m_audioPktQueue.seekRequestTime.store(0);
+    m_videoPktQueue.seekTarget.store(AV_NOPTS_VALUE);
+    m_videoPktQueue.seekRequestTime.store(0);
+    m_audioPktDecoder.seekTarget = AV_NOPTS_VALUE;
+    m_videoPktDecoder.seekTarget = AV_NOPTS_VALUE;
+    m_audioPktDecoder.skipping = false;
+    m_videoPktDecoder.skipping = false;
+    m_lastKeyframePts = AV_NOPTS_VALUE;
 }
 
-void Decoder::exit()
+void Decoder::stop()
 {
-    if(m_exit.load()) return;
     m_exit.store(true);
-    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    // 唤醒阻塞在队列上的各线程
+    m_audioPktQueue.ring.wakeAll();
+    m_videoPktQueue.ring.wakeAll();
+    MemoryBudget::instance().wakeAll();
+    m_audioFrameQueue.ring.wakeAll();
+    m_videoFrameQueue.ring.wakeAll();
+}
 
-    clearQueueCache();
-    if(m_pAvFormatCtx != nullptr){
-        avformat_close_input(&m_pAvFormatCtx);
-        m_pAvFormatCtx = nullptr;
+void Decoder::exit()
+{
+    int64_t start = av_gettime_relative();
+    stop();
+    waitCodecOpen();
+    bool running = !m_threads.empty();
+    m_threads.joinAll(); // 各阶段退出后才能释放它们使用的资源
+    if(running){
+        QLOG_INFO() << "decoder stages joined in" << (av_gettime_relative() - start) / 1000.0 << "ms";
     }
+
+    clearQueueCache();
+    m_keyframeIndex.save();
+    m_keyframeIndex.clear();
+    // 解码器放回复用池, 需要打开时的流参数, 先于关闭文件
     if(m_audioPktDecoder.codecCtx != nullptr){
-        avcodec_free_context(&m_audioPktDecoder.codecCtx);
+        CodecContextPool::instance().release(m_audioPktDecoder.codecCtx, m_pAvFormatCtx->streams[m_audioIndex]->codecpar);
         m_audioPktDecoder.codecCtx = nullptr;
     }
     if(m_videoPktDecoder.codecCtx != nullptr){
-        avcodec_free_context(&m_videoPktDecoder.codecCtx);
+        CodecContextPool::instance().release(m_videoPktDecoder.codecCtx, m_pAvFormatCtx->streams[m_videoIndex]->codecpar);
         m_videoPktDecoder.codecCtx = nullptr;
     }
+    if(m_shiftCtx != nullptr){
+        avformat_close_input(&m_shiftCtx);
+        m_shiftCtx = nullptr;
+    }
+    m_shiftSource.reset();
+    m_shifted = false;
+    m_recorder.stop();
+    if(m_pAvFormatCtx != nullptr){
+        avformat_close_input(&m_pAvFormatCtx);
+        m_pAvFormatCtx = nullptr;
+    }
+    m_startTime.store(0);
+    {
+        std::lock_guard<std::mutex> lock(m_metricsMutex);
+        m_readAhead = nullptr;
+        m_httpSource = nullptr;
+        m_ioSource.reset();
+    }
+    ThreadBudget::instance().release(m_audioPktDecoder.threads);
+    ThreadBudget::instance().release(m_videoPktDecoder.threads);
+    m_audioPktDecoder.threads = 1;
+    m_videoPktDecoder.threads = 1;
+    // 各阶段已结束, 清除退出标志后才能再次open(), open()期间的stop()不会被覆盖
+    m_exit.store(false);
 }
 
-void Decoder::seekTo(int32_t target)
+int Decoder::wantedThreads(bool isVideo) const
 {
-    if(m_isSeek) return; // 上次跳转未完成, 此次不予处理
-    m_seekTarget = target;
-    m_isSeek = true;
+    int wanted = isVideo ? m_threadingPolicy.videoThreads : m_threadingPolicy.audioThreads;
+    return wanted > 0 ? wanted : CODEC_MAX_AUTO_THREADS;
 }
 
-void Decoder::clearQueueCache()
+void Decoder::applyThreadingPolicy(FPktDecoder *decoder, bool isVideo)
 {
-    {
-        std::lock_guard<std::mutex> lock(m_audioPktQueue.mutex);
-        while(m_audioPktQueue.size > 0){
-            av_packet_unref(&m_audioPktQueue.pktVec[m_audioPktQueue.readIndex].pkt);
-//          AVPacket *packet = &m_audioPktQueue.pktVec[m_audioPktQueue.readIndex].pkt;
-//          av_packet_unref(packet);
-//          av_packet_free(&packet);
-            m_audioPktQueue.readIndex = (m_audioPktQueue.readIndex + 1) % m_maxPktQueueSize;
-            m_audioPktQueue.size--;
-        }
+    AVCodecContext *ctx = decoder->codecCtx;
+    decoder->threads = ThreadBudget::instance().acquire(wantedThreads(isVideo));
+
+    ctx->thread_count = decoder->threads;
+    ctx->thread_type = m_threadingPolicy.threadType;
+    if(m_threadingPolicy.lowDelay || m_live.load()){
+        // 帧级并行会缓存thread_count-1帧, 低延迟模式只允许片级并行
+        ctx->thread_type &= ~FF_THREAD_FRAME;
+        ctx->flags |= AV_CODEC_FLAG_LOW_DELAY;
     }
-    {
-        std::lock_guard<std::mutex> lock(m_videoPktQueue.mutex);
-        while(m_videoPktQueue.size > 0){
-            av_packet_unref(&m_videoPktQueue.pktVec[m_videoPktQueue.readIndex].pkt);
-//          AVPacket *packet = &m_videoPktQueue.pktVec[m_videoPktQueue.readIndex].pkt;
-//          av_packet_unref(packet);
-//          av_packet_free(&packet);
-            m_videoPktQueue.readIndex = (m_videoPktQueue.readIndex + 1) % m_maxPktQueueSize;
-            m_videoPktQueue.size--;
-        }
+    QLOG_INFO() << (isVideo ? "video" : "audio") << "codec threads:" << ctx->thread_count
+                << "type:" << ctx->thread_type;
+}
+
+void Decoder::seekTo(double target, SeekMode mode)
+{
+    // 新目标直接覆盖尚未执行的旧目标
+    // 流内的时间戳从start_time开始, 字节估算/索引/丢帧都按绝对时间戳比较
+    m_seekTarget.store((int64_t)(target * AV_TIME_BASE) + m_startTime.load());
+    m_seekMode.store(mode);
+    m_seekRequestTime.store(av_gettime_relative());
+    m_seekSerial++; // 打断正在阻塞的读/跳转操作
+    m_isSeek.store(true);
+    // demux可能阻塞在已满的包队列上, 或在文件末尾等待音频取空
+    MemoryBudget::instance().wakeAll();
+    m_audioPktQueue.ring.wakeAll();
+    m_audioFrameQueue.ring.wakeAll();
+    m_videoFrameQueue.ring.wakeAll(); // 视频解码线程可能阻塞在已满的帧队列上
+}
+
+void Decoder::setPacketQueueLimits(int64_t maxBytes, double maxDuration)
+{
+    m_maxPktQueueBytes.store(maxBytes);
+    m_maxPktQueueDuration.store((int64_t)(maxDuration * AV_TIME_BASE));
+    MemoryBudget::instance().wakeAll();
+}
+
+void Decoder::setTimeshift(bool enable, double window)
+{
+    m_timeshift.store(enable);
+    m_timeshiftWindow.store((int64_t)(window * AV_TIME_BASE));
+}
+
+bool Decoder::timeshiftRange(double *start, double *end) const
+{
+    int64_t first = 0, last = 0;
+    if(!m_recorder.range(&first, &last)) return false;
+    *start = first / (double)AV_TIME_BASE;
+    *end = last / (double)AV_TIME_BASE;
+    return true;
+}
+
+bool Decoder::isLiveUrl(const QString &url)
+{
+    QString scheme = QUrl(url).scheme().toLower();
+    return scheme == "udp" || scheme == "rtp" || scheme == "rtsp" || scheme == "rtsps" ||
+            scheme == "srt" || scheme == "rtmp";
+}
+
+bool Decoder::isNetworkPath(const QString &url)
+{
+    return url.startsWith("//") || url.startsWith("\\\\");
+}
+
+void Decoder::setProbeLimits(int64_t probeSize, double analyzeDuration)
+{
+    m_probeSize.store(probeSize);
+    m_analyzeDuration.store((int64_t)(analyzeDuration * AV_TIME_BASE));
+}
+
+void Decoder::setIoTimeouts(double openTimeout, double readTimeout)
+{
+    m_openTimeout.store((int64_t)(openTimeout * AV_TIME_BASE));
+    m_readTimeout.store((int64_t)(readTimeout * AV_TIME_BASE));
+}
+
+Decoder::IoMetrics Decoder::ioMetrics() const
+{
+    std::lock_guard<std::mutex> lock(m_metricsMutex);
+    IoMetrics metrics = m_ioMetrics;
+    if(m_readAhead){
+        ReadAheadSource::Stats stats = m_readAhead->stats();
+        metrics.readAheadBytes = stats.buffered;
+        metrics.readAheadCapacity = stats.capacity;
+        metrics.readAheadStalls = stats.stalls;
+        metrics.maxStallMs = stats.maxStallMs;
     }
-    {
-        std::lock_guard<std::mutex> lock(m_audioFrameQueue.mutex);
-        while(m_audioFrameQueue.size > 0){
-            av_frame_unref(&m_audioFrameQueue.frameVec[m_audioFrameQueue.readIndex].frame);
-//          AVFrame *frame = &m_audioFrameQueue.frameVec[m_audioFrameQueue.readIndex].frame;
-//          av_frame_unref(frame);
-//          av_frame_free(&frame);
-            m_audioFrameQueue.readIndex = (m_audioPktQueue.readIndex + 1) % m_maxFrameQueueSize;
-            m_audioFrameQueue.size--;
-        }
+    if(m_httpSource){
+        HttpSource::Stats stats = m_httpSource->stats();
+        metrics.httpNetworkBytes = stats.networkBytes;
+        metrics.httpCacheBytes = stats.cacheBytes;
+        metrics.httpRequests = stats.requests;
+    }
+    return metrics;
+}
+
+void Decoder::setReadAhead(int64_t depth, int chunkSize)
+{
+    m_readAheadDepth.store(depth);
+    m_readAheadChunk.store(chunkSize);
+}
+
+int Decoder::ioInterruptCallback(void *opaque)
+{
+    Decoder *decoder = static_cast<Decoder*>(opaque);
+    if(decoder->m_exit.load()) return 1;
+    if((decoder->m_ioOp == IO_READ || decoder->m_ioOp == IO_SEEK) &&
+            decoder->m_ioSeekSerial != decoder->m_seekSerial.load()){
+        return 1; // 放弃本次读取/跳转, 尽快去处理最新的跳转
+    }
+    if(decoder->m_ioDeadline > 0 && av_gettime_relative() > decoder->m_ioDeadline){
+        decoder->m_ioTimedOut = true;
+        return 1;
     }
+    return 0;
+}
+
+void Decoder::beginIo(IoOp op, int64_t timeout)
+{
+    m_ioStart = av_gettime_relative();
+    m_ioDeadline = timeout > 0 ? m_ioStart + timeout : 0;
+    m_ioSeekSerial = m_seekSerial.load();
+    m_ioTimedOut = false;
+    m_ioOp = op;
+}
+
+double Decoder::endIo(int errNum)
+{
+    double elapsed = (av_gettime_relative() - m_ioStart) / 1000.0;
     {
-        std::lock_guard<std::mutex> lock(m_videoFrameQueue.mutex);
-        while(m_videoFrameQueue.size > 0){
-            av_frame_unref(&m_videoFrameQueue.frameVec[m_videoFrameQueue.readIndex].frame);
-//          AVFrame *frame = &m_videoFrameQueue.frameVec[m_videoFrameQueue.readIndex].frame;
-//          av_frame_unref(frame);
-//          av_frame_free(&frame);
-            m_videoPktQueue.readIndex = (m_videoFrameQueue.readIndex + 1) % m_maxFrameQueueSize;
-            m_videoFrameQueue.size--;
+        std::lock_guard<std::mutex> lock(m_metricsMutex);
+        if(m_ioOp == IO_OPEN && m_ioTimedOut){
+            m_ioMetrics.openTimeouts++;
+        }
+        else if(m_ioOp == IO_READ || m_ioOp == IO_SEEK){
+            m_ioMetrics.maxReadMs = FFMAX(m_ioMetrics.maxReadMs, elapsed);
+            if(m_ioTimedOut) m_ioMetrics.readTimeouts++;
+        }
+        if(errNum == AVERROR_EXIT && !m_ioTimedOut){
+            m_ioMetrics.interrupts++;
         }
     }
+    m_ioOp = IO_NONE;
+    m_ioDeadline = 0;
+    return elapsed;
 }
 
-bool Decoder::decode(const QString &url) //从视频内部获取信息填充成员变量
+double Decoder::audioBufferedDuration() const
 {
+    return m_audioPktQueue.duration.load() / (double)AV_TIME_BASE;
+}
+
+double Decoder::videoBufferedDuration() const
+{
+    return m_videoPktQueue.duration.load() / (double)AV_TIME_BASE;
+}
+
+void Decoder::clearQueueCache() // 仅在解析线程全部退出后调用
+{
+    while(!m_audioPktQueue.ring.empty()){
+        packetQueuePop(&m_audioPktQueue, nullptr);
+    }
+    while(!m_videoPktQueue.ring.empty()){
+        packetQueuePop(&m_videoPktQueue, nullptr);
+    }
+    FFrame *frame = nullptr;
+    while((frame = m_audioFrameQueue.ring.peek()) != nullptr){
+        av_frame_unref(&frame->frame);
+        m_audioFrameQueue.ring.pop();
+    }
+    while((frame = m_videoFrameQueue.ring.peek()) != nullptr){
+        av_frame_unref(&frame->frame);
+        m_videoFrameQueue.ring.pop();
+    }
+    m_audioFrameQueue.shown = 0;
+    m_videoFrameQueue.shown = 0;
+}
+
+bool Decoder::decode(const QString &url)
+{
+    return open(url) && start();
+}
+
+bool Decoder::open(const QString &url) //从视频内部获取信息填充成员变量
+{
+    if(m_exit.load()) return false; // 已被stop(), 等exit()之后再打开
 
     initVal();
     m_pAvFormatCtx = avformat_alloc_context();
+    m_pAvFormatCtx->interrupt_callback.callback = &Decoder::ioInterruptCallback;
+    m_pAvFormatCtx->interrupt_callback.opaque = this;
+    {
+        std::lock_guard<std::mutex> lock(m_metricsMutex);
+        m_ioMetrics = IoMetrics();
+    }
+
+    // 本地文件走内存映射, HTTP(S)走带磁盘缓存的范围请求
+    // 只有HTTP(S)和网络共享上的文件外面再套一层预读, 本地磁盘映射后已在内存中, 预读只会多一次拷贝
+    // 打开失败时退回libavformat自带的协议
+    std::unique_ptr<IOSource> source;
+    HttpSource *httpSource = nullptr;
+    if(m_mappedIoWindow.load() > 0 && QFileInfo(url).isFile()){
+        source.reset(new MappedFileSource(m_mappedIoWindow.load()));
+    }
+    else if(HttpSource::isHttpUrl(url)){
+        httpSource = new HttpSource(m_httpDiskCache.load());
+        source.reset(httpSource);
+    }
+    if(source){
+        ReadAheadSource *readAhead = nullptr;
+        if(m_readAheadDepth.load() > 0 && (httpSource || isNetworkPath(url))){
+            readAhead = new ReadAheadSource(std::move(source), m_readAheadDepth.load(), m_readAheadChunk.load());
+            readAhead->setInterruptCallback(&Decoder::ioInterruptCallback, this);
+            source.reset(readAhead);
+        }
+        AVIOContext *avio = source->open(url) ? source->avioContext() : nullptr;
+        if(avio){
+            m_pAvFormatCtx->pb = avio;
+            std::lock_guard<std::mutex> lock(m_metricsMutex);
+            m_ioSource = std::move(source);
+            m_readAhead = readAhead;
+            m_httpSource = httpSource;
+        }
+    }
+
+    // 直播只探测最少的数据, 不在libavformat中缓存探测读到的包, 解复用不等待重排
+    bool live = m_liveMode.load() || isLiveUrl(url);
+    m_live.store(live);
+    // 帧队列在解码线程启动前按模式调整, 直播只保留几帧
+    size_t frameQueueSize = live ? LIVE_FRAME_QUEUE_SIZE : m_maxFrameQueueSize;
+    if(m_audioFrameQueue.ring.capacity() != frameQueueSize){
+        m_audioFrameQueue.ring.resize(frameQueueSize);
+        m_videoFrameQueue.ring.resize(frameQueueSize);
+    }
 
+    // 同时限制格式探测(avformat_open_input)和流信息探测(avformat_find_stream_info)
     AVDictionary *fmtOpt = nullptr;
-    av_dict_set(&fmtOpt, "probesize", "32", 0);
+    av_dict_set_int(&fmtOpt, "probesize", live ? LIVE_PROBE_SIZE : m_probeSize.load(), 0);
+    av_dict_set_int(&fmtOpt, "analyzeduration", live ? (int64_t)(LIVE_ANALYZE_DURATION * AV_TIME_BASE) : m_analyzeDuration.load(), 0);
+    if(live){
+        av_dict_set(&fmtOpt, "fflags", "nobuffer", 0);
+        av_dict_set_int(&fmtOpt, "max_delay", (int64_t)(LIVE_MAX_DELAY * AV_TIME_BASE), 0);
+    }
 
-    int errorNum = avformat_open_input(&m_pAvFormatCtx, url.toUtf8().constData(), nullptr, nullptr);
+    beginIo(IO_OPEN, m_openTimeout.load());
+    int errorNum = avformat_open_input(&m_pAvFormatCtx, url.toUtf8().constData(), nullptr, &fmtOpt);
+    double openMs = endIo(errorNum);
+    av_dict_free(&fmtOpt);
     if(errorNum < 0){
         av_strerror(errorNum, m_errBuf, sizeof(m_errBuf));
         QLOG_ERROR() << "avformat_open_input fail: " << m_errBuf;
-        av_dict_free(&fmtOpt);
         return false;
     }
 
-    // get context
-    errorNum = avformat_find_stream_info(m_pAvFormatCtx, nullptr);
+    // get context, 缓存命中且参数齐全时跳过探测
+    bool cached = !live && m_streamInfoCache.load() && StreamInfoCache::restore(url, m_pAvFormatCtx);
+    double probeMs = 0.0;
+    if(!cached){
+        beginIo(IO_OPEN, m_openTimeout.load());
+        errorNum = avformat_find_stream_info(m_pAvFormatCtx, nullptr);
+        probeMs = endIo(errorNum);
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_metricsMutex);
+        m_ioMetrics.openMs = openMs;
+        m_ioMetrics.probeMs = probeMs;
+        m_ioMetrics.probeCached = cached;
+    }
+    if(cached){
+        QLOG_INFO() << "open:" << openMs << "ms, stream info from cache";
+    }
+    else{
+        QLOG_INFO() << "open:" << openMs << "ms, find stream info:" << probeMs << "ms";
+    }
     if(errorNum < 0){
         av_strerror(errorNum, m_errBuf, sizeof(m_errBuf));
         QLOG_ERROR() << "avformat_find_stream_info fail: " << m_errBuf;
-        av_dict_free(&fmtOpt);
         return false;
     }
+    if(!cached && !live && m_streamInfoCache.load()){
+        StreamInfoCache::store(url, m_pAvFormatCtx);
+    }
+
+    m_keyframeIndex.load(url);
 
     // get duration
     AVRational ratio = {1, AV_TIME_BASE}; // 1 / 1000000
-    m_duration = (uint32_t)m_pAvFormatCtx->duration * av_q2d(ratio);
-    av_dict_free(&fmtOpt);
+    m_duration = m_pAvFormatCtx->duration == AV_NOPTS_VALUE ? 0 : (uint32_t)(m_pAvFormatCtx->duration * av_q2d(ratio));
+    m_startTime.store(m_pAvFormatCtx->start_time == AV_NOPTS_VALUE ? 0 : m_pAvFormatCtx->start_time);
 
     //get index
     m_videoIndex = av_find_best_stream(m_pAvFormatCtx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
@@ -174,68 +472,101 @@ bool Decoder::decode(const QString &url) //从视频内部获取信息填充成
         return false;
     }
 
-    // get decoder
-    const AVCodec *audioCodec = avcodec_find_decoder(m_pAvFormatCtx->streams[m_audioIndex]->codecpar->codec_id);
-    if(!audioCodec){
-        QLOG_ERROR() << "avcodec_find_decoder audio fail";
-        return false;
-    }
-    m_audioPktDecoder.codecCtx = avcodec_alloc_context3(audioCodec);
-    if(!m_audioPktDecoder.codecCtx){
-        QLOG_ERROR() << "avcodec_alloc_context3 audio fail";
-        return false;
-    }
-    errorNum = avcodec_parameters_to_context(m_audioPktDecoder.codecCtx, m_pAvFormatCtx->streams[m_audioIndex]->codecpar);
-    if(errorNum < 0){
-        av_strerror(errorNum, m_errBuf, sizeof(m_errBuf));
-        QLOG_ERROR() << "avcodec_parameters_to_context audio fail" << m_errBuf;
-        return false;
-    }
-    errorNum = avcodec_open2(m_audioPktDecoder.codecCtx, audioCodec, nullptr);
-    if(errorNum < 0){
-        av_strerror(errorNum, m_errBuf, sizeof(m_errBuf));
-        QLOG_ERROR() << "avcodec_open2 audio fail" << m_errBuf;
-        return false;
-    }
-
-    const AVCodec *videoCodec = avcodec_find_decoder(m_pAvFormatCtx->streams[m_videoIndex]->codecpar->codec_id);
-    if(!videoCodec){
-        QLOG_ERROR() << "avcodec_find_decoder video fail";
-        return false;
-    }
-    m_videoPktDecoder.codecCtx = avcodec_alloc_context3(videoCodec);
-    if(!m_videoPktDecoder.codecCtx){
-        QLOG_ERROR() << "avcodec_alloc_context3 video fail";
-        return false;
-    }
-    errorNum = avcodec_parameters_to_context(m_videoPktDecoder.codecCtx, m_pAvFormatCtx->streams[m_videoIndex]->codecpar);
-    if(errorNum < 0){
-        av_strerror(errorNum, m_errBuf, sizeof(m_errBuf));
-        QLOG_ERROR() << "avcodec_parameters_to_context video fail" << m_errBuf;
-        return false;
-    }
-    errorNum = avcodec_open2(m_videoPktDecoder.codecCtx, videoCodec, nullptr);
-    if(errorNum < 0){
-        av_strerror(errorNum, m_errBuf, sizeof(m_errBuf));
-        QLOG_ERROR() << "avcodec_open2 video fail" << m_errBuf;
-        return false;
+    if(live && m_timeshift.load() &&
+            !m_recorder.start(m_pAvFormatCtx, m_audioIndex, m_videoIndex, m_timeshiftWindow.load() / (double)AV_TIME_BASE)){
+        QLOG_ERROR() << "start timeshift fail, play without it";
     }
 
     //get frame rate
     m_videoFrameRate = av_guess_frame_rate(m_pAvFormatCtx, m_pAvFormatCtx->streams[m_videoIndex], nullptr);
 
+    // 两路解码器在线程池中并行打开, 期间demux已经开始读包
+    m_audioCodecOpen = ThreadPool::instance().commitTask([this](){
+        return this->openCodec(&m_audioPktDecoder, m_audioIndex, false);
+    });
+    m_videoCodecOpen = ThreadPool::instance().commitTask([this](){
+        return this->openCodec(&m_videoPktDecoder, m_videoIndex, true);
+    });
+
     // get packet
-    ThreadPool::instance().commitTask([this](){
+    m_threads.start("demux", [this](){
         this->demux();
     });
+    return true;
+}
+
+bool Decoder::start()
+{
+    // 线程池已停止时future无效, 在当前线程打开
+    bool audioOpened = m_audioCodecOpen.valid() ? m_audioCodecOpen.get() : openCodec(&m_audioPktDecoder, m_audioIndex, false);
+    bool videoOpened = m_videoCodecOpen.valid() ? m_videoCodecOpen.get() : openCodec(&m_videoPktDecoder, m_videoIndex, true);
+    if(!audioOpened || !videoOpened) return false;
+
     // get frame
-    ThreadPool::instance().commitTask([this](){
+    m_threads.start("audioDecode", [this](){
         this->audioDecode();
     });
-    ThreadPool::instance().commitTask([this](){
+    m_threads.start("videoDecode", [this](){
         this->videoDecode();
     });
+    return true;
+}
 
+void Decoder::waitCodecOpen()
+{
+    if(m_audioCodecOpen.valid()) m_audioCodecOpen.wait();
+    if(m_videoCodecOpen.valid()) m_videoCodecOpen.wait();
+    m_audioCodecOpen = std::future<bool>();
+    m_videoCodecOpen = std::future<bool>();
+}
+
+bool Decoder::openCodec(FPktDecoder *decoder, int streamIndex, bool isVideo) // 在线程池中执行
+{
+    int64_t start = av_gettime_relative();
+    const char *type = isVideo ? "video" : "audio";
+    char errBuf[100];
+    AVCodecParameters *codecPar = m_pAvFormatCtx->streams[streamIndex]->codecpar;
+    // 上一个文件使用了相同参数的解码器时直接复用
+    decoder->codecCtx = CodecContextPool::instance().acquire(codecPar, m_threadingPolicy.threadType,
+                                                             m_threadingPolicy.lowDelay || m_live.load(),
+                                                             wantedThreads(isVideo));
+    if(decoder->codecCtx){
+        // 复用的解码器已按打开时的线程数创建了内部线程, 领取不到同样数量的预算时不能复用
+        int threads = decoder->codecCtx->thread_count;
+        decoder->threads = ThreadBudget::instance().acquire(threads);
+        if(decoder->threads >= threads){
+            QLOG_INFO() << type << "codec reused in" << (av_gettime_relative() - start) / 1000.0 << "ms";
+            return true;
+        }
+        QLOG_INFO() << type << "codec not reused, thread budget" << decoder->threads << "<" << threads;
+        ThreadBudget::instance().release(decoder->threads);
+        decoder->threads = 1;
+        avcodec_free_context(&decoder->codecCtx);
+    }
+    const AVCodec *codec = avcodec_find_decoder(codecPar->codec_id);
+    if(!codec){
+        QLOG_ERROR() << "avcodec_find_decoder" << type << "fail";
+        return false;
+    }
+    decoder->codecCtx = avcodec_alloc_context3(codec);
+    if(!decoder->codecCtx){
+        QLOG_ERROR() << "avcodec_alloc_context3" << type << "fail";
+        return false;
+    }
+    int errorNum = avcodec_parameters_to_context(decoder->codecCtx, codecPar);
+    if(errorNum < 0){
+        av_strerror(errorNum, errBuf, sizeof(errBuf));
+        QLOG_ERROR() << "avcodec_parameters_to_context" << type << "fail" << errBuf;
+        return false;
+    }
+    applyThreadingPolicy(decoder, isVideo);
+    errorNum = avcodec_open2(decoder->codecCtx, codec, nullptr);
+    if(errorNum < 0){
+        av_strerror(errorNum, errBuf, sizeof(errBuf));
+        QLOG_ERROR() << "avcodec_open2" << type << "fail" << errBuf;
+        return false;
+    }
+    QLOG_INFO() << type << "codec opened in" << (av_gettime_relative() - start) / 1000.0 << "ms";
     return true;
 }
 
@@ -246,77 +577,334 @@ void Decoder::demux()
 
     while(true){
         if(m_exit.load()) break;
-        if(m_audioPktQueue.size >= m_maxPktQueueSize || m_videoPktQueue.size >= m_maxPktQueueSize){
-            std::this_thread::sleep_for(std::chrono::milliseconds(50));
-            continue;
-        }
-        if(m_isSeek){
-            int64_t target = m_seekTarget * AV_TIME_BASE;
-            errNum = av_seek_frame(m_pAvFormatCtx, -1, target, AVSEEK_FLAG_BACKWARD);
+        if(m_isSeek.exchange(false)){
+            // 取最新的目标, 之前被覆盖的请求不再执行
+            int64_t requestTime = m_seekRequestTime.load();
+            int64_t target = m_seekTarget.load();
+            bool toLive = false;
+            beginIo(IO_SEEK, m_readTimeout.load());
+            errNum = m_recorder.isRecording() ? seekTimeshift(target, &toLive) : seekStream(target);
+            bool timedOut = m_ioTimedOut;
+            endIo(errNum);
+            if(errNum == AVERROR_EXIT && !timedOut){ // 被更新的跳转打断
+                continue;
+            }
             if(errNum < 0){
                 av_strerror(errNum, m_errBuf, sizeof(m_errBuf));
                 QLOG_ERROR() << "av_seek_frame fail" << m_errBuf;
             }
             else{
-                packetQueueFlush(&m_audioPktQueue);
-                packetQueueFlush(&m_videoPktQueue);
-                m_audSeek = true;
-                m_vidSeek = true;
+                m_eof.store(false);
+                m_lastKeyframePts = AV_NOPTS_VALUE; // 跳过的区间不连续
+                // 快速跳转不丢帧, 从关键帧开始播放; 回到直播时从最新的数据开始
+                int64_t discardBefore = m_seekMode.load() == SEEK_EXACT && !toLive ? target : AV_NOPTS_VALUE;
+                packetQueueFlush(&m_audioPktQueue, discardBefore, requestTime);
+                packetQueueFlush(&m_videoPktQueue, discardBefore, requestTime);
             }
-            m_isSeek = false;
         }
 
-        errNum = av_read_frame(m_pAvFormatCtx, pkt);
+        beginIo(IO_READ, m_readTimeout.load());
+        errNum = av_read_frame(m_shifted ? m_shiftCtx : m_pAvFormatCtx, pkt);
+        bool timedOut = m_ioTimedOut;
+        endIo(errNum);
+        if(errNum == AVERROR_EXIT && !timedOut){ // 被退出或新的跳转打断
+            continue;
+        }
         if(errNum == AVERROR_EOF){
-            av_packet_free(&pkt);
-            QLOG_INFO() << "read file end, success";
-            break;
+            if(!m_eof.exchange(true)){
+                m_videoFrameQueue.ring.wakeAll(); // 视频线程可能在等待新帧
+            }
+            // 等待剩余的音频播放完毕, 期间有新的跳转则继续读取
+            auto interrupted = [this](){return m_exit.load() || m_isSeek.load();};
+            if(m_audioPktQueue.ring.waitDrained(interrupted) && m_audioFrameQueue.ring.waitDrained(interrupted)){
+                QLOG_INFO() << "read file end, success";
+                // 资源由播放器收到结束通知后调用exit()释放
+                m_finished.store(true);
+                break;
+            }
+            continue;
         }
         else if(errNum < 0){
             av_packet_free(&pkt);
             av_strerror(errNum, m_errBuf, sizeof(m_errBuf));
-            QLOG_ERROR() << "av_read_frame fail" << m_errBuf;
+            QLOG_ERROR() << (timedOut ? "av_read_frame timeout" : "av_read_frame fail") << m_errBuf;
             break;
         }
 
+        if(m_shifted){
+            if(!mapTimeshiftPacket(pkt)){
+                av_packet_unref(pkt);
+                continue;
+            }
+        }
+        else{
+            m_recorder.push(pkt); // 未在录制时直接返回
+        }
+
+        FPacketQueue *queue = nullptr;
         if(pkt->stream_index == m_audioIndex){
-            pushPacket(&m_audioPktQueue, pkt);
+            queue = &m_audioPktQueue;
+            if(pkt->pts != AV_NOPTS_VALUE){
+                m_audioReadPts.store(av_rescale_q(pkt->pts, m_pAvFormatCtx->streams[m_audioIndex]->time_base, AV_TIME_BASE_Q));
+            }
         }
         else if(pkt->stream_index == m_videoIndex){
-            pushPacket(&m_videoPktQueue, pkt);
+            queue = &m_videoPktQueue;
+            recordKeyframe(pkt);
         }
         else{
             av_packet_unref(pkt);
+            continue;
         }
+        // 缓存足够时阻塞, 直到解码线程取走数据, 或者有新的跳转/退出请求
+        bool accepted = MemoryBudget::instance().wait([&](){return packetQueueAccept(queue);},
+                                                      [this](){return m_exit.load() || m_isSeek.load();});
+        if(!accepted){
+            av_packet_unref(pkt);
+            continue;
+        }
+        pushPacket(queue, pkt);
     }
 
+    leaveTimeshift();
     av_packet_free(&pkt);
-    if(!m_exit.load()){
-        while(m_audioFrameQueue.size > 0){
-            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    QLOG_INFO() << "demux thread exit";
+}
+
+int Decoder::seekStream(int64_t target)
+{
+    KeyframeIndex::Entry entry;
+    if(!(m_pAvFormatCtx->iformat->flags & AVFMT_NO_BYTE_SEEK) &&
+            m_keyframeIndex.find(target, &entry, true)){
+        // 直接定位到目标之前的关键帧, 不需要容器层面的查找
+        int errNum = av_seek_frame(m_pAvFormatCtx, -1, entry.pos, AVSEEK_FLAG_BYTE);
+        if(errNum >= 0 || errNum == AVERROR_EXIT) return errNum;
+        QLOG_INFO() << "byte seek fail, fall back to timestamp seek";
+    }
+    if(useEstimatedSeek()){
+        int errNum = seekByEstimate(target);
+        if(errNum >= 0 || errNum == AVERROR_EXIT) return errNum;
+        QLOG_INFO() << "estimated seek fail, fall back to timestamp seek";
+    }
+    return av_seek_frame(m_pAvFormatCtx, -1, target, AVSEEK_FLAG_BACKWARD);
+}
+
+bool Decoder::useEstimatedSeek() const
+{
+    const AVInputFormat *format = m_pAvFormatCtx->iformat;
+    if((format->flags & AVFMT_NO_BYTE_SEEK) || !m_pAvFormatCtx->pb) return false;
+    if(strcmp(format->name, "mpegts") == 0) return true;
+    return strcmp(format->name, "flv") == 0 &&
+            avformat_index_get_entries_count(m_pAvFormatCtx->streams[m_videoIndex]) == 0;
+}
+
+int64_t Decoder::estimateBytePos(int64_t target) const
+{
+    int64_t fileSize = avio_size(m_pAvFormatCtx->pb);
+    int64_t startTime = m_pAvFormatCtx->start_time != AV_NOPTS_VALUE ? m_pAvFormatCtx->start_time : 0;
+    KeyframeIndex::Entry before{startTime, 0, 0, 0};
+    KeyframeIndex::Entry after{AV_NOPTS_VALUE, fileSize, 0, 0};
+    m_keyframeIndex.find(target, &before, false);
+    if(!m_keyframeIndex.findAfter(target, &after) && m_pAvFormatCtx->duration != AV_NOPTS_VALUE){
+        after.pts = startTime + m_pAvFormatCtx->duration;
+    }
+    int64_t pos = -1;
+    if(after.pts != AV_NOPTS_VALUE && after.pts > before.pts && after.pos > before.pos){
+        pos = before.pos + av_rescale(target - before.pts, after.pos - before.pos, after.pts - before.pts);
+    }
+    else if(m_pAvFormatCtx->bit_rate > 0){
+        pos = before.pos + av_rescale(target - before.pts, m_pAvFormatCtx->bit_rate, 8 * (int64_t)AV_TIME_BASE);
+    }
+    if(pos < 0) return before.pos;
+    return fileSize > 0 ? FFMIN(pos, fileSize - 1) : pos;
+}
+
+int Decoder::seekByEstimate(int64_t target)
+{
+    AVPacket *pkt = av_packet_alloc();
+    AVRational timeBase = m_pAvFormatCtx->streams[m_videoIndex]->time_base;
+    int64_t backoff = (int64_t)(SEEK_ESTIMATE_BACKOFF * AV_TIME_BASE);
+    int64_t lastPos = -1;
+    int errNum = AVERROR(ENOSYS);
+    for(int i = 0; i < SEEK_ESTIMATE_ITERATIONS; i++){
+        int64_t pos = estimateBytePos(target - backoff);
+        if(pos == lastPos) break; // 估算不再变化, 索引中没有更多信息
+        lastPos = pos;
+        errNum = av_seek_frame(m_pAvFormatCtx, -1, pos, AVSEEK_FLAG_BYTE);
+        if(errNum < 0) break;
+
+        // 向后扫描视频关键帧: best为不晚于目标的最后一个, 遇到晚于目标的关键帧即确定了GOP
+        KeyframeIndex::Entry best{AV_NOPTS_VALUE, -1, 0, 0};
+        int64_t prevPts = AV_NOPTS_VALUE;
+        bool passed = false;
+        while(true){
+            errNum = av_read_frame(m_pAvFormatCtx, pkt);
+            if(errNum < 0) break;
+            bool key = pkt->stream_index == m_videoIndex && (pkt->flags & AV_PKT_FLAG_KEY) && pkt->pos >= 0;
+            int64_t pts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+            int64_t pktPos = pkt->pos;
+            av_packet_unref(pkt);
+            if(pktPos >= 0 && pktPos - pos > SEEK_ESTIMATE_SCAN_BYTES) break;
+            if(!key || pts == AV_NOPTS_VALUE) continue;
+            pts = av_rescale_q(pts, timeBase, AV_TIME_BASE_Q);
+            m_keyframeIndex.add(pts, pktPos, prevPts);
+            prevPts = pts;
+            if(pts > target){
+                passed = true;
+                break;
+            }
+            best = KeyframeIndex::Entry{pts, pktPos, 0, 0};
         }
-        exit();
+        if(errNum == AVERROR_EXIT) break;
+        if(best.pos >= 0 && passed){
+            av_packet_free(&pkt);
+            QLOG_INFO() << "estimated seek settled after" << i + 1 << "probes";
+            return av_seek_frame(m_pAvFormatCtx, -1, best.pos, AVSEEK_FLAG_BYTE);
+        }
+        if(best.pos < 0 && !passed && errNum < 0) break; // 读到末尾仍没有关键帧
+        // 新记录的关键帧成为锚点后重新估算; 落点已过目标所在的GOP时提前更多
+        if(best.pos < 0) backoff *= 2;
+        errNum = AVERROR(ENOSYS);
     }
-    QLOG_INFO() << "demux thread exit";
+    av_packet_free(&pkt);
+    return errNum == AVERROR_EXIT ? errNum : AVERROR(ENOSYS);
+}
+
+int Decoder::seekTimeshift(int64_t target, bool *live)
+{
+    int64_t start = 0, end = 0;
+    if(!m_recorder.range(&start, &end) || target >= end){
+        leaveTimeshift();
+        *live = true;
+        return 0;
+    }
+    if(!m_shiftCtx){
+        int errNum = openTimeshiftInput();
+        if(errNum < 0) return errNum;
+    }
+    // 每个分段从关键帧开始, 定位到目标所在的分段即可, 其余由精确跳转丢弃
+    int errNum = av_seek_frame(m_shiftCtx, -1, m_recorder.offsetFor(target), AVSEEK_FLAG_BYTE);
+    if(errNum < 0) return errNum;
+    enterTimeshift();
+    return 0;
+}
+
+int Decoder::openTimeshiftInput()
+{
+    m_shiftSource.reset(new TimeshiftSource(&m_recorder));
+    m_shiftSource->setInterruptCallback(&Decoder::ioInterruptCallback, this);
+    AVIOContext *avio = m_shiftSource->open(QString()) ? m_shiftSource->avioContext() : nullptr;
+    if(!avio){
+        m_shiftSource.reset();
+        return AVERROR(EIO);
+    }
+    m_shiftCtx = avformat_alloc_context();
+    m_shiftCtx->pb = avio;
+    m_shiftCtx->interrupt_callback.callback = &Decoder::ioInterruptCallback;
+    m_shiftCtx->interrupt_callback.opaque = this;
+    // 录制的格式已知, 流参数取自直播输入, 不需要探测
+    int errNum = avformat_open_input(&m_shiftCtx, "timeshift", av_find_input_format("mpegts"), nullptr);
+    if(errNum < 0){
+        m_shiftCtx = nullptr; // 失败时已被释放
+        m_shiftSource.reset();
+        av_strerror(errNum, m_errBuf, sizeof(m_errBuf));
+        QLOG_ERROR() << "open timeshift input fail" << m_errBuf;
+    }
+    return errNum;
+}
+
+void Decoder::enterTimeshift()
+{
+    if(m_shifted) return;
+    // 采集线程读取期间只响应退出和停止采集, 不受demux的跳转/超时影响
+    m_captureStop.store(false);
+    m_pAvFormatCtx->interrupt_callback.callback = &Decoder::captureInterruptCallback;
+    {
+        std::lock_guard<std::mutex> lock(m_metricsMutex);
+        if(m_readAhead) m_readAhead->setInterruptCallback(&Decoder::captureInterruptCallback, this);
+    }
+    m_captureThread.start("capture", [this](){
+        this->captureLive();
+    });
+    m_shifted = true;
+    QLOG_INFO() << "timeshift: play from recording";
+}
+
+void Decoder::leaveTimeshift()
+{
+    if(!m_shifted) return;
+    m_captureStop.store(true);
+    m_captureThread.joinAll();
+    m_pAvFormatCtx->interrupt_callback.callback = &Decoder::ioInterruptCallback;
+    {
+        std::lock_guard<std::mutex> lock(m_metricsMutex);
+        if(m_readAhead) m_readAhead->setInterruptCallback(&Decoder::ioInterruptCallback, this);
+    }
+    m_shifted = false;
+    QLOG_INFO() << "timeshift: back to live";
+}
+
+void Decoder::captureLive()
+{
+    AVPacket *pkt = av_packet_alloc();
+    while(!m_captureStop.load() && !m_exit.load()){
+        int errNum = av_read_frame(m_pAvFormatCtx, pkt);
+        if(errNum == AVERROR_EXIT) continue;
+        if(errNum < 0){
+            char errBuf[AV_ERROR_MAX_STRING_SIZE] = {0};
+            av_strerror(errNum, errBuf, sizeof(errBuf));
+            QLOG_ERROR() << "timeshift capture stopped:" << errBuf;
+            break;
+        }
+        m_recorder.push(pkt);
+        av_packet_unref(pkt);
+    }
+    av_packet_free(&pkt);
+}
+
+bool Decoder::mapTimeshiftPacket(AVPacket *pkt)
+{
+    AVStream *stream = m_shiftCtx->streams[pkt->stream_index];
+    int index = stream->codecpar->codec_type == AVMEDIA_TYPE_AUDIO ? m_audioIndex
+              : stream->codecpar->codec_type == AVMEDIA_TYPE_VIDEO ? m_videoIndex : -1;
+    if(index < 0) return false;
+    av_packet_rescale_ts(pkt, stream->time_base, m_pAvFormatCtx->streams[index]->time_base);
+    pkt->stream_index = index;
+    pkt->pos = -1; // 录制文件中的位置, 不记入关键帧索引
+    return true;
+}
+
+int Decoder::captureInterruptCallback(void *opaque)
+{
+    Decoder *decoder = static_cast<Decoder*>(opaque);
+    return decoder->m_exit.load() || decoder->m_captureStop.load() ? 1 : 0;
+}
+
+void Decoder::recordKeyframe(const AVPacket *pkt)
+{
+    if(!(pkt->flags & AV_PKT_FLAG_KEY) || pkt->pos < 0) return;
+    // 直播和时长未知的输入不能按字节跳转, 索引也不保存, 长时间运行只会不断增长
+    if(m_live.load() || m_pAvFormatCtx->duration == AV_NOPTS_VALUE) return;
+    int64_t pts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+    if(pts == AV_NOPTS_VALUE) return;
+    pts = av_rescale_q(pts, m_pAvFormatCtx->streams[m_videoIndex]->time_base, AV_TIME_BASE_Q);
+    m_keyframeIndex.add(pts, pkt->pos, m_lastKeyframePts);
+    m_lastKeyframePts = pts;
 }
 
 void Decoder::audioDecode()
 {
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
     AVPacket *pkt = av_packet_alloc();
     AVFrame *frame = av_frame_alloc();
 
     while(true){
         if(m_exit.load()) break;
-        if(m_audioFrameQueue.size >= m_maxFrameQueueSize){
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
-            continue;
-        }
         int errNum = getPacket(&m_audioPktQueue, pkt, &m_audioPktDecoder);
         if(errNum){
             errNum = avcodec_send_packet(m_audioPktDecoder.codecCtx, pkt);
             av_packet_unref(pkt);
             if(errNum < 0){
+                m_audioPktDecoder.busy.store(false);
                 av_strerror(errNum, m_errBuf, sizeof(m_errBuf));
                 QLOG_ERROR() << "avcodec_send_packet audio fail" << m_errBuf;
                 continue;
@@ -324,15 +912,13 @@ void Decoder::audioDecode()
             while(true){
                 errNum = avcodec_receive_frame(m_audioPktDecoder.codecCtx, frame);
                 if(errNum == 0){ //sucess
-                    if(m_audSeek){
-                        int pts = (int)frame->pts * av_q2d(m_pAvFormatCtx->streams[m_audioIndex]->time_base);
-                        if(pts < m_seekTarget){
-                            av_frame_unref(frame);
-                            continue;
-                        }
-                        else{
-                            m_audSeek = 0;
-                        }
+                    if(m_audioPktDecoder.serial != m_audioPktQueue.serial.load()){
+                        av_frame_unref(frame); // 已有更新的跳转, 放弃当前序号剩余的解码
+                        break;
+                    }
+                    if(!passSeekTarget(&m_audioPktDecoder, frame, m_audioIndex)){
+                        av_frame_unref(frame);
+                        continue;
                     }
                     pushAFrame(frame);
                 }
@@ -340,9 +926,7 @@ void Decoder::audioDecode()
                     break;
                 }
             }
-        }
-        else{
-            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            m_audioPktDecoder.busy.store(false);
         }
     }
     av_packet_free(&pkt);
@@ -352,20 +936,18 @@ void Decoder::audioDecode()
 
 void Decoder::videoDecode()
 {
-    //std::this_thread::sleep_for(std::chrono::milliseconds(100));
     AVPacket *pkt = av_packet_alloc();
     AVFrame *frame = av_frame_alloc();
     while(true){
         if(m_exit.load()) break;
-        if(m_videoFrameQueue.size >= m_maxFrameQueueSize){
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
-            continue;
-        }
         int errNum = getPacket(&m_videoPktQueue, pkt, &m_videoPktDecoder);
         if(errNum){
+            int seekSerial = m_seekSerial.load(); // 之后再有跳转请求, 这个包解出的帧都已过期
+            updateSeekSkip(&m_videoPktDecoder, pkt, m_videoIndex);
             errNum = avcodec_send_packet(m_videoPktDecoder.codecCtx, pkt);
             av_packet_unref(pkt);
             if(errNum < 0 || errNum == AVERROR(EAGAIN) || errNum == AVERROR_EOF){
+                m_videoPktDecoder.busy.store(false);
                 av_strerror(errNum, m_errBuf, sizeof(m_errBuf));
                 QLOG_ERROR() << "avcodec_send_packet video fail" << m_errBuf;
                 continue;
@@ -373,25 +955,24 @@ void Decoder::videoDecode()
             while(true){
                 errNum = avcodec_receive_frame(m_videoPktDecoder.codecCtx, frame);
                 if(errNum == 0){
-                    if(m_vidSeek){
-                        int pts = (int)frame->pts * av_q2d(m_pAvFormatCtx->streams[m_videoIndex]->time_base);
-                        if(pts < m_seekTarget){
-                            av_frame_unref(frame);
-                            continue;
-                        }
-                        else{
-                            m_vidSeek = 0;
-                        }
+                    if(m_videoPktDecoder.serial != m_videoPktQueue.serial.load()){
+                        av_frame_unref(frame); // 已有更新的跳转, 放弃当前序号剩余的解码
+                        break;
                     }
-                    pushVFrame(frame);
+                    if(!passSeekTarget(&m_videoPktDecoder, frame, m_videoIndex)){
+                        av_frame_unref(frame);
+                        continue;
+                    }
+                    pushVFrame(frame, seekSerial);
                 }
                 else{
                     break;
                 }
             }
-        }
-        else{
-            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            m_videoPktDecoder.busy.store(false);
+            if(m_eof.load()){
+                m_videoFrameQueue.ring.wakeAll(); // 可能是最后一个包, 视频线程据此判断是否播完
+            }
         }
     }
     av_packet_free(&pkt);
@@ -399,140 +980,218 @@ void Decoder::videoDecode()
     QLOG_INFO() << "video decode thread exit";
 }
 
-void Decoder::packetQueueFlush(FPacketQueue *queue)
+void Decoder::packetQueueFlush(FPacketQueue *queue, int64_t seekTarget, int64_t requestTime)
 {
-    std::lock_guard<std::mutex> lock(queue->mutex);
-    while(queue->size > 0){
-        av_packet_unref(&queue->pktVec[queue->readIndex].pkt);
-        queue->readIndex = (queue->readIndex + 1) % m_maxPktQueueSize;
-        queue->size--;
-    }
+    // 先写跳转目标再递增序号, 解码线程切换到新序号时能读到对应的目标
+    queue->seekTarget.store(seekTarget);
+    queue->seekRequestTime.store(requestTime);
+    // 生产者不能动读索引, 只递增序号, 旧序号的包由消费者在getPacket中丢弃
     queue->serial++;
 }
 
+void Decoder::packetQueuePop(FPacketQueue *queue, AVPacket *destPkt)
+{
+    FPacket *pkt = queue->ring.peek();
+    int size = pkt->pkt.size;
+    int64_t duration = pkt->duration;
+    if(destPkt){
+        av_packet_move_ref(destPkt, &pkt->pkt);
+    }
+    else{
+        av_packet_unref(&pkt->pkt);
+    }
+    queue->ring.pop();
+    // 先归还槽位再释放预算, 被唤醒的demux线程能看到空出的槽位
+    queue->bytes.fetch_sub(size);
+    queue->duration.fetch_sub(duration);
+    MemoryBudget::instance().release(size);
+}
+
+bool Decoder::packetQueueEnough(const FPacketQueue *queue) const
+{
+    if(queue->bytes.load() >= m_maxPktQueueBytes.load()) return true;
+    return queue->ring.size() > PKT_QUEUE_MIN_PACKETS &&
+            queue->duration.load() >= (m_live.load() ? (int64_t)(LIVE_PKT_QUEUE_DURATION * AV_TIME_BASE) : m_maxPktQueueDuration.load());
+}
+
+bool Decoder::packetQueueAccept(const FPacketQueue *queue) const
+{
+    if(queue->ring.full()) return false;
+    if(queue->ring.size() < PKT_QUEUE_MIN_PACKETS) return true;
+    if(MemoryBudget::instance().exceeded()) return false;
+    // 只要还有一路缓存不足就继续读, 避免一路队列满导致另一路饿死
+    return !(packetQueueEnough(&m_audioPktQueue) && packetQueueEnough(&m_videoPktQueue));
+}
+
 void Decoder::pushPacket(FPacketQueue *queue, AVPacket *pkt)
 {
-    std::lock_guard<std::mutex> lock(queue->mutex);
-    av_packet_move_ref(&queue->pktVec[queue->pushIndex].pkt, pkt);
-    queue->pktVec[queue->pushIndex].serial = queue->serial;
-    queue->pushIndex = (queue->pushIndex + 1) % m_maxPktQueueSize;
-    queue->size++;
+    FPacket *slot = queue->ring.pushSlot();
+    if(!slot){
+        av_packet_unref(pkt);
+        return;
+    }
+    AVRational timeBase = m_pAvFormatCtx->streams[pkt->stream_index]->time_base;
+    slot->duration = pkt->duration > 0 ? av_rescale_q(pkt->duration, timeBase, AV_TIME_BASE_Q) : 0;
+    slot->serial = queue->serial.load();
+    queue->bytes.fetch_add(pkt->size);
+    queue->duration.fetch_add(slot->duration);
+    MemoryBudget::instance().acquire(pkt->size);
+    av_packet_move_ref(&slot->pkt, pkt);
+    queue->ring.commitPush();
 }
 
 int Decoder::getPacket(FPacketQueue *queue, AVPacket *destPkt, FPktDecoder *decoder)
 {
-    std::unique_lock<std::mutex> lock(queue->mutex);
-    while(queue->size == 0){
-        bool ret = queue->cond.wait_for(lock, std::chrono::milliseconds(100), [&](){
-            return queue->size > 0;
-        });
-        if(ret == false){
-            return 0;
-        }
+    if(!queue->ring.waitReadable(1, [this](){return m_exit.load();})){
+        return 0;
     }
-    if(decoder->serial != queue->serial){
-        avcodec_flush_buffers(decoder->codecCtx);
-        decoder->serial = queue->pktVec[queue->readIndex].serial;
+    FPacket *pkt = queue->ring.peek();
+    if(pkt->serial != queue->serial.load()){ // 跳转之前的包
+        packetQueuePop(queue, nullptr);
         return 0;
     }
-    av_packet_move_ref(destPkt, &queue->pktVec[queue->readIndex].pkt);
-    decoder->serial = queue->pktVec[queue->readIndex].serial;
-    queue->readIndex = (queue->readIndex + 1) % m_maxPktQueueSize;
-    queue->size--;
+    if(decoder->serial != pkt->serial){
+        avcodec_flush_buffers(decoder->codecCtx);
+        decoder->serial = pkt->serial;
+        decoder->seekTarget = queue->seekTarget.load();
+    }
+    decoder->busy.store(true); // 先于出队, 队列为空时不会被误判为已播完
+    packetQueuePop(queue, destPkt);
     return true;
 }
 
-void Decoder::pushAFrame(AVFrame *frame)
+bool Decoder::passSeekTarget(FPktDecoder *decoder, AVFrame *frame, int streamIndex)
 {
-    std::lock_guard<std::mutex> lock(m_audioFrameQueue.mutex);
-    av_frame_move_ref(&m_audioFrameQueue.frameVec[m_audioFrameQueue.pushIndex].frame, frame);
-    m_audioFrameQueue.frameVec[m_audioFrameQueue.pushIndex].serial = m_audioPktDecoder.serial;
-    m_audioFrameQueue.pushIndex = (m_audioFrameQueue.pushIndex + 1) % m_maxFrameQueueSize;
-    m_audioFrameQueue.size++;
+    if(decoder->seekTarget == AV_NOPTS_VALUE) return true;
+    if(frame->pts != AV_NOPTS_VALUE){
+        int64_t pts = av_rescale_q(frame->pts, m_pAvFormatCtx->streams[streamIndex]->time_base, AV_TIME_BASE_Q);
+        if(pts < decoder->seekTarget) return false;
+    }
+    decoder->seekTarget = AV_NOPTS_VALUE; // 到达目标, 之后的帧正常输出
+    return true;
+}
+
+void Decoder::updateSeekSkip(FPktDecoder *decoder, const AVPacket *pkt, int streamIndex)
+{
+    bool skip = false;
+    if(decoder->seekTarget != AV_NOPTS_VALUE){
+        int64_t pts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+        if(pts != AV_NOPTS_VALUE){
+            pts = av_rescale_q(pts, m_pAvFormatCtx->streams[streamIndex]->time_base, AV_TIME_BASE_Q);
+            skip = pts < decoder->seekTarget - (int64_t)(SEEK_EXACT_FULL_DECODE * AV_TIME_BASE);
+        }
+    }
+    if(skip == decoder->skipping) return;
+    decoder->skipping = skip;
+    // 帧级多线程在每次送包时同步这些字段, 可以逐包切换
+    AVCodecContext *ctx = decoder->codecCtx;
+    ctx->skip_frame = skip ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+    ctx->skip_loop_filter = skip && m_seekSkipLoopFilter.load() ? AVDISCARD_ALL : AVDISCARD_DEFAULT;
 }
 
-void Decoder::pushVFrame(AVFrame *frame)
+void Decoder::pushAFrame(AVFrame *frame)
 {
-    std::lock_guard<std::mutex> lock(m_videoFrameQueue.mutex);
-    m_videoFrameQueue.frameVec[m_videoFrameQueue.pushIndex].serial = m_videoPktDecoder.serial;
-    m_videoFrameQueue.frameVec[m_videoFrameQueue.pushIndex].pts = frame->pts * av_q2d(m_pAvFormatCtx->streams[m_videoIndex]->time_base);
-    m_videoFrameQueue.frameVec[m_videoFrameQueue.pushIndex].duration = m_videoFrameRate.den && m_videoFrameRate.num ? av_q2d(AVRational{m_videoFrameRate.num, m_videoFrameRate.den}) : 0.00;
-    av_frame_move_ref(&m_videoFrameQueue.frameVec[m_videoFrameQueue.pushIndex].frame, frame);
-    m_videoFrameQueue.pushIndex = (m_videoFrameQueue.pushIndex + 1) % m_maxFrameQueueSize;
-    m_videoFrameQueue.size++;
+    FFrame *slot = nullptr;
+    if(m_audioFrameQueue.ring.waitWritable([this](){return m_exit.load();})){
+        slot = m_audioFrameQueue.ring.pushSlot();
+    }
+    if(!slot){
+        av_frame_unref(frame);
+        return;
+    }
+    av_frame_move_ref(&slot->frame, frame);
+    slot->serial = m_audioPktDecoder.serial;
+    m_audioFrameQueue.ring.commitPush();
 }
 
-int Decoder::getAFrame(AVFrame *frame)
+void Decoder::pushVFrame(AVFrame *frame, int seekSerial)
 {
-    if(!frame) return 0;
-    std::unique_lock<std::mutex> lock(m_audioFrameQueue.mutex);
-    while(m_audioFrameQueue.size == 0){
-        bool ret = m_audioFrameQueue.cond.wait_for(lock, std::chrono::milliseconds(100), [&](){
-            return !m_exit.load() && m_audioFrameQueue.size;
-        });
-        if(!ret) return 0;
+    FFrame *slot = nullptr;
+    if(m_videoFrameQueue.ring.waitWritable([this, seekSerial](){
+        return m_exit.load() || m_seekSerial.load() != seekSerial;
+    })){
+        slot = m_videoFrameQueue.ring.pushSlot();
     }
+    if(!slot){
+        av_frame_unref(frame);
+        return;
+    }
+    slot->serial = m_videoPktDecoder.serial;
+    slot->pts = frame->pts * av_q2d(m_pAvFormatCtx->streams[m_videoIndex]->time_base);
+    slot->duration = m_videoFrameRate.den && m_videoFrameRate.num ? av_q2d(AVRational{m_videoFrameRate.num, m_videoFrameRate.den}) : 0.00;
+    av_frame_move_ref(&slot->frame, frame);
+    m_videoFrameQueue.ring.commitPush();
+}
 
-    if(m_audioFrameQueue.frameVec[m_audioFrameQueue.readIndex].serial != m_audioPktQueue.serial){
-        av_frame_unref(&m_audioFrameQueue.frameVec[m_audioFrameQueue.readIndex].frame);
-        m_audioFrameQueue.readIndex = (m_audioFrameQueue.readIndex + 1) % m_maxFrameQueueSize;
-        m_audioFrameQueue.size--;
-        return 0;
+int Decoder::getAFrame(AVFrame *frame, int *serial) // 在音频回调中调用, 不阻塞
+{
+    if(!frame || m_exit.load()) return 0;
+    FFrame *slot = nullptr;
+    while((slot = m_audioFrameQueue.ring.peek()) != nullptr){
+        if(slot->serial == m_audioPktQueue.serial.load()) break;
+        av_frame_unref(&slot->frame); // 跳转之前的帧
+        m_audioFrameQueue.ring.pop();
     }
-    av_frame_move_ref(frame, &m_audioFrameQueue.frameVec[m_audioFrameQueue.readIndex].frame);
-    m_audioFrameQueue.readIndex = (m_audioFrameQueue.readIndex + 1) % m_maxFrameQueueSize;
-    m_audioFrameQueue.size--;
+    if(!slot) return 0;
+    if(serial) *serial = slot->serial;
+    av_frame_move_ref(frame, &slot->frame);
+    m_audioFrameQueue.ring.pop();
     return 1;
 }
 
 int Decoder::getRemainingVFrameSize()
 {
-    std::lock_guard<std::mutex> lock(m_videoFrameQueue.mutex);
-    if(m_videoFrameQueue.size == 0) return 0;
-    return m_videoFrameQueue.size - m_videoFrameQueue.shown;
+    int size = (int)m_videoFrameQueue.ring.size();
+    if(size == 0) return 0;
+    return size - m_videoFrameQueue.shown;
 }
 
 Decoder::FFrame *Decoder::getLastVFrame()
 {
-    FFrame *frame = &m_videoFrameQueue.frameVec[m_videoFrameQueue.readIndex];
-    return frame;
+    return m_videoFrameQueue.ring.peek();
+}
+
+bool Decoder::waitVFrame()
+{
+    size_t count = m_videoFrameQueue.shown + 1;
+    return m_videoFrameQueue.ring.waitReadable(count, [this](){return m_exit.load() || videoFinished();});
+}
+
+bool Decoder::audioFinished() const
+{
+    return m_eof.load() && !m_isSeek.load() && m_audioPktQueue.ring.empty() &&
+            !m_audioPktDecoder.busy.load() && m_audioFrameQueue.ring.empty();
+}
+
+bool Decoder::videoFinished()
+{
+    return m_eof.load() && !m_isSeek.load() && m_videoPktQueue.ring.empty() &&
+            !m_videoPktDecoder.busy.load() && getRemainingVFrameSize() == 0;
 }
 
 Decoder::FFrame *Decoder::getVFrame()
 {
-    while(m_videoFrameQueue.size == 0){
-        std::unique_lock<std::mutex> lock(m_videoFrameQueue.mutex);
-        bool ret = m_videoFrameQueue.cond.wait_for(lock, std::chrono::milliseconds(100), [&](){
-            return !m_exit.load() && m_videoFrameQueue.size;
-        });
-        if(ret == false) return nullptr;
-    }
-    int index = (m_videoFrameQueue.readIndex + m_videoFrameQueue.shown) % m_maxFrameQueueSize;
-    FFrame *frame = &m_videoFrameQueue.frameVec[index];
-    return frame;
+    if(!waitVFrame()) return nullptr;
+    return m_videoFrameQueue.ring.peek(m_videoFrameQueue.shown);
 }
 
 Decoder::FFrame *Decoder::getNextVFrame()
 {
-    while(m_videoFrameQueue.size < 2){
-        std::unique_lock<std::mutex> lock(m_videoFrameQueue.mutex);
-        bool ret = m_videoFrameQueue.cond.wait_for(lock, std::chrono::milliseconds(100), [&](){
-            return !m_exit.load() && m_videoFrameQueue.size >= 2;
-        });
-        if(ret == false) return nullptr;
+    size_t index = m_videoFrameQueue.shown + 1;
+    if(!m_videoFrameQueue.ring.waitReadable(index + 1, [this](){return m_exit.load();})){
+        return nullptr;
     }
-    int index = (m_videoFrameQueue.readIndex + m_videoFrameQueue.shown + 1) % m_maxFrameQueueSize;
-    FFrame *frame = &m_videoFrameQueue.frameVec[index];
-    return frame;
+    return m_videoFrameQueue.ring.peek(index);
 }
 
 void Decoder::setNextVFrame()
 {
-    std::lock_guard<std::mutex> lock(m_videoFrameQueue.mutex);
-    if(m_videoFrameQueue.size == 0) return;
-    if(m_videoFrameQueue.shown == 0) m_videoFrameQueue.shown = 1;
-    av_frame_unref(&m_videoFrameQueue.frameVec[m_videoFrameQueue.readIndex].frame);
-    m_videoFrameQueue.readIndex = (m_videoFrameQueue.readIndex + 1) % m_maxFrameQueueSize;
-    m_videoFrameQueue.size--;
+    FFrame *frame = m_videoFrameQueue.ring.peek();
+    if(!frame) return;
+    if(m_videoFrameQueue.shown == 0){ // 保留刚显示的帧作为上一帧
+        m_videoFrameQueue.shown = 1;
+        return;
+    }
+    av_frame_unref(&frame->frame);
+    m_videoFrameQueue.ring.pop();
 }
-
@@ -1,35 +1,194 @@
 #ifndef DECODER_H
 #define DECODER_H
 
-#include <QVector>
-#include <condition_variable>
+#include <QString>
+#include <atomic>
+#include <memory>
+#include <future>
+#include "SpscRing.h"
+#include "PipelineThreads.h"
+#include "KeyframeIndex.h"
+#include "MappedFileSource.h"
+#include "ReadAheadSource.h"
+#include "HttpSource.h"
+#include "TimeshiftRecorder.h"
+#include "TimeshiftSource.h"
 
 extern "C"{
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 }
 
+// 包队列中少于该数量时不受字节/时长/全局预算限制, 防止另一路流饿死
+#define PKT_QUEUE_MIN_PACKETS 25
+// 单路包队列默认缓存上限
+#define PKT_QUEUE_MAX_BYTES (16 * 1024 * 1024)
+#define PKT_QUEUE_MAX_DURATION 2.0
+// 探测流信息的默认上限, 与libavformat默认值一致
+#define PROBE_SIZE_DEFAULT 5000000
+#define ANALYZE_DURATION_DEFAULT 5.0
+// 阻塞IO默认超时, 秒
+#define IO_OPEN_TIMEOUT 10.0
+#define IO_READ_TIMEOUT 5.0
+// 自动分配时单路视频解码的线程上限, 与libavcodec的自动线程上限一致
+#define CODEC_MAX_AUTO_THREADS 16
+// 精确跳转时距目标该时长(秒)以内恢复完整解码
+#define SEEK_EXACT_FULL_DECODE 0.5
+// TS/FLV按码率估算字节位置跳转: 最多估算次数, 每次从估算位置向后扫描的字节上限,
+// 估算时提前的时长(秒), 使落点尽量在目标之前
+#define SEEK_ESTIMATE_ITERATIONS 6
+#define SEEK_ESTIMATE_SCAN_BYTES (4 * 1024 * 1024)
+#define SEEK_ESTIMATE_BACKOFF 1.0
+// 直播模式: 探测上限, 包队列时长上限(秒), 帧队列槽位数, 解复用重排等待(秒)
+#define LIVE_PROBE_SIZE 32768
+#define LIVE_ANALYZE_DURATION 0.1
+#define LIVE_PKT_QUEUE_DURATION 0.3
+#define LIVE_FRAME_QUEUE_SIZE 4
+#define LIVE_MAX_DELAY 0.05
+
 class Decoder // 将传输过来的视频文件解析为yuv
 {
 public:
+    // 解码器内部多线程策略, 在decode()打开解码器时生效
+    struct ThreadingPolicy{
+        // FF_THREAD_FRAME: 帧级并行, 吞吐高但每个线程多一帧延迟
+        // FF_THREAD_SLICE: 片级并行, 不增加延迟, 取决于码流是否分片
+        int threadType = FF_THREAD_FRAME | FF_THREAD_SLICE;
+        int videoThreads = 0; // <=0: 从进程线程预算中自动分配
+        int audioThreads = 1;
+        // 低延迟: 只使用片级并行, 并设置AV_CODEC_FLAG_LOW_DELAY
+        bool lowDelay = false;
+    };
+
+    // 阻塞IO统计, 由AVIOInterruptCB配合各操作的计时得到
+    struct IoMetrics{
+        double openMs = 0.0; // avformat_open_input 耗时
+        double probeMs = 0.0; // avformat_find_stream_info 耗时
+        bool probeCached = false; // 流信息来自缓存, 跳过了探测
+        double maxReadMs = 0.0; // 单次 av_read_frame 最长耗时
+        int openTimeouts = 0;
+        int readTimeouts = 0;
+        int interrupts = 0; // 因退出/跳转被打断的次数
+        // 预读缓冲区, 未启用预读时均为0
+        int64_t readAheadBytes = 0; // 读位置之后已缓冲的字节数
+        int64_t readAheadCapacity = 0;
+        int readAheadStalls = 0; // demux等待预读数据的次数
+        double maxStallMs = 0.0;
+        // HTTP数据源, 未使用时均为0
+        int64_t httpNetworkBytes = 0;
+        int64_t httpCacheBytes = 0; // 由磁盘缓存提供的字节数
+        int httpRequests = 0;
+    };
+
+    enum SeekMode{
+        SEEK_FAST, // 停在目标之前的关键帧, 不丢弃任何帧
+        SEEK_EXACT // 从关键帧解码到目标, 目标之前的帧不输出
+    };
+
     explicit Decoder();
     ~Decoder();
 
+    // open() + start()
     bool decode(const QString& url);
+    /**
+     * @brief 探测流信息并开始读包, 两路解码器在线程池中异步打开
+     * 返回后即可读取流参数, 调用方可以同时准备音频设备等
+     */
+    bool open(const QString& url);
+    // 等待解码器打开完成并启动解码线程
+    bool start();
+    // 通知各阶段退出并唤醒阻塞的线程, 不等待
+    void stop();
+    // stop() 后等待各阶段线程结束, 再释放资源, 之后可以重新open()
     void exit();
 
     inline uint32_t duraiton() const {return m_duration;}
+    // 首个时间戳(秒), 跳转目标和进度都以它为0点; 广播TS等格式通常不为0
+    inline double startTime() const {return m_startTime.load() / (double)AV_TIME_BASE;}
+    // udp/rtp/rtsp/srt/rtmp地址按直播打开
+    static bool isLiveUrl(const QString& url);
+    // 网络共享(UNC)路径上的文件, 内存映射的缺页会阻塞在网络上
+    static bool isNetworkPath(const QString& url);
+    // 强制按直播打开, 下次decode()生效
+    inline void setLiveMode(bool live) {m_liveMode.store(live);}
+    // 当前打开的是否为直播源
+    inline bool isLive() const {return m_live.load();}
+    /**
+     * @brief 直播时移, 下次decode()生效, 只对直播源有效
+     * demux读到的包同时写入本地分段文件, 之后可以暂停或跳转到已录制的范围
+     * @param window 保留的时长(秒), 超出后删除最早的分段
+     */
+    void setTimeshift(bool enable, double window = TIMESHIFT_WINDOW);
+    // 已录制的时间范围(秒), 未在录制时返回false
+    bool timeshiftRange(double *start, double *end) const;
+    // demux最近读到的音频包时间戳(秒), 与正在播放的时间戳之差即缓存的延迟
+    inline double audioReadPts() const {return m_audioReadPts.load() / (double)AV_TIME_BASE;}
     inline int audioIndex() const {return m_audioIndex;}
     inline int videoIndex() const {return m_videoIndex;}
     inline bool isExit() const {return m_exit.load();}
-    inline int videoPktSerial() const {return m_videoPktQueue.serial;}
+    // 文件已读完且音频全部取走
+    inline bool isFinished() const {return m_finished.load();}
+    // 已读到文件末尾, 且音频包/帧全部取走, 音频回调中判断是否切换到下一项
+    bool audioFinished() const;
+    // 已读到文件末尾, 且视频帧全部显示, 仅视频线程调用
+    bool videoFinished();
+    inline int videoPktSerial() const {return m_videoPktQueue.serial.load();}
     inline AVCodecParameters *auidoCodecPar() const {return m_pAvFormatCtx->streams[m_audioIndex]->codecpar;}
     inline AVCodecParameters *videoCodecPar() const {return m_pAvFormatCtx->streams[m_videoIndex]->codecpar;}
     inline AVFormatContext *formatContext() const {return m_pAvFormatCtx;}
 
-    int getAFrame(AVFrame *frame);
+    /**
+     * @brief 单路包队列的缓存上限, 两路都达到上限后demux才会阻塞
+     * 进程内总量另受 MemoryBudget 约束
+     * @param maxBytes 字节数上限
+     * @param maxDuration 缓存时长上限(秒)
+     */
+    void setPacketQueueLimits(int64_t maxBytes, double maxDuration);
+    inline void setThreadingPolicy(const ThreadingPolicy& policy) {m_threadingPolicy = policy;}
+    inline const ThreadingPolicy& threadingPolicy() const {return m_threadingPolicy;}
+    /**
+     * @brief 阻塞IO的超时, 超时后由中断回调打断
+     * @param openTimeout 打开及探测流信息(秒)
+     * @param readTimeout 单次读包/跳转(秒)
+     */
+    void setIoTimeouts(double openTimeout, double readTimeout);
+    /**
+     * @brief 探测流信息的上限, 下次decode()生效
+     * @param probeSize 探测读取的字节数
+     * @param analyzeDuration 探测分析的时长(秒)
+     */
+    void setProbeLimits(int64_t probeSize, double analyzeDuration);
+    // 是否使用本地文件的流信息缓存
+    inline void setStreamInfoCache(bool enable) {m_streamInfoCache.store(enable);}
+    // 本地文件的内存映射窗口大小, <=0 时使用libavformat默认的文件协议, 下次decode()生效
+    inline void setMappedIoWindow(int64_t bytes) {m_mappedIoWindow.store(bytes);}
+    /**
+     * @brief HTTP(S)和网络共享路径的预读缓冲区, 由独立线程读取, demux只从内存解析, 下次decode()生效
+     * 本地磁盘上的文件已内存映射, 不再额外预读
+     * @param depth 缓冲区大小(字节), <=0 时不预读
+     * @param chunkSize 预读线程单次读取的大小
+     */
+    void setReadAhead(int64_t depth, int chunkSize = READ_AHEAD_CHUNK);
+    // HTTP(S)是否使用分段磁盘缓存, 下次decode()生效
+    inline void setHttpDiskCache(bool enable) {m_httpDiskCache.store(enable);}
+    IoMetrics ioMetrics() const;
+    // 包队列中已缓存的时长(秒)
+    double audioBufferedDuration() const;
+    double videoBufferedDuration() const;
+
+    // serial不为空时返回帧所属的跳转序号
+    int getAFrame(AVFrame *frame, int *serial = nullptr);
     int getRemainingVFrameSize();
-    void seekTo(int32_t target);
+    // 跳转到target(秒, 相对startTime()), 只保留最新的请求, 正在执行的旧跳转会被放弃
+    void seekTo(double target, SeekMode mode = SEEK_EXACT);
+    /**
+     * @brief 精确跳转时目标之前的帧是否同时跳过环路滤波
+     * 非参考帧总是直接丢弃; 跳过参考帧的环路滤波更快, 但误差会沿参考链
+     * 带到目标之后, 直到下一个关键帧
+     */
+    inline void setSeekSkipLoopFilter(bool skip) {m_seekSkipLoopFilter.store(skip);}
+    // 产生当前视频包序号的那次跳转请求的时间(av_gettime_relative)
+    inline int64_t videoSeekRequestTime() const {return m_videoPktQueue.seekRequestTime.load();}
 
 private:
     void initVal(); //复用播放器 重置变量
@@ -38,7 +197,8 @@ private:
     void videoDecode();
     void clearQueueCache();
     void pushAFrame(AVFrame *frame);
-    void pushVFrame(AVFrame *frame);
+    // seekSerial: 取到该帧所在包时的跳转请求序号, 等待空位期间序号变化则丢弃该帧
+    void pushVFrame(AVFrame *frame, int seekSerial);
 
 
 public:
@@ -53,65 +213,86 @@ private:
     struct FPacket{
         AVPacket pkt;
         int serial;
+        int64_t duration; // 微秒
     };
 
+    // 生产者: demux线程, 消费者: 对应的解码线程
     struct FPacketQueue{
-        QVector<FPacket> pktVec;
-        int readIndex;
-        int pushIndex;
-        int size;
-        int serial;
-        std::mutex mutex;
-        std::condition_variable cond;
+        SpscRing<FPacket> ring;
+        std::atomic_int serial; // 跳转时由demux线程递增
+        std::atomic<int64_t> bytes; // 队列中包数据的总字节数
+        std::atomic<int64_t> duration; // 队列中包的总时长, 微秒
+        std::atomic<int64_t> seekTarget; // 当前序号对应的跳转目标, 微秒, 无跳转为AV_NOPTS_VALUE
+        std::atomic<int64_t> seekRequestTime;
     };
 
+    // 生产者: 解码线程, 消费者: 音频回调/视频渲染线程
     struct FFrameQueue{
-        QVector<FFrame> frameVec;
-        int readIndex;
-        int pushIndex;
-        int size;
-        int shown; // 已经显示过的帧
-        std::mutex mutex;
-        std::condition_variable cond;
+        SpscRing<FFrame> ring;
+        int shown; // 已经显示过的帧, 仅消费者访问
     };
 
     struct FPktDecoder{
       AVCodecContext *codecCtx = nullptr;
       int serial;
+      int threads = 1; // 从ThreadBudget领取的线程数
+      int64_t seekTarget = AV_NOPTS_VALUE; // 丢弃该时间(微秒)之前的帧
+      bool skipping = false; // 是否处于跳转前的降级解码
+      std::atomic_bool busy{false}; // 已取出包但帧还没有全部推入帧队列
     };
 
     std::atomic_bool m_exit;
+    std::atomic_bool m_finished;
+    std::atomic_bool m_eof; // demux读到文件末尾, 跳转后清除
+    PipelineThreads m_threads;
 
     AVFormatContext *m_pAvFormatCtx;
     char m_errBuf[100];
     uint32_t m_duration;
+    std::atomic<int64_t> m_startTime; // 微秒, 未知时为0
     int m_videoIndex;
     int m_audioIndex;
 
     FPktDecoder m_audioPktDecoder;
     FPktDecoder m_videoPktDecoder;
+    std::future<bool> m_audioCodecOpen;
+    std::future<bool> m_videoCodecOpen;
 
     AVRational m_videoFrameRate;
+    ThreadingPolicy m_threadingPolicy;
 
     FPacketQueue m_audioPktQueue;
     FPacketQueue m_videoPktQueue;
     FFrameQueue m_audioFrameQueue;
     FFrameQueue m_videoFrameQueue;
 
-    const int m_maxPktQueueSize;
+    const int m_maxPktQueueSize; // 包队列槽位数, 硬上限
     const int m_maxFrameQueueSize;
+    std::atomic<int64_t> m_maxPktQueueBytes;
+    std::atomic<int64_t> m_maxPktQueueDuration; // 微秒
 
-    // 是否进行跳转
-    bool m_isSeek;
-    bool m_vidSeek;
-    bool m_audSeek;
+    std::atomic_bool m_liveMode;
+    std::atomic_bool m_live;
+    std::atomic<int64_t> m_audioReadPts; // 微秒
 
-    //跳转的绝对时间
-    int64_t m_seekTarget;
+    // 是否有待执行的跳转
+    std::atomic_bool m_isSeek;
+    //最新的跳转目标, 微秒
+    std::atomic<int64_t> m_seekTarget;
+    std::atomic_int m_seekMode;
+    std::atomic_bool m_seekSkipLoopFilter;
+    std::atomic<int64_t> m_seekRequestTime;
+    // 每次跳转请求递增, 用于打断跳转之前发起的读操作
+    std::atomic_int m_seekSerial;
+
+    KeyframeIndex m_keyframeIndex; // 仅demux线程及线程退出后访问
+    int64_t m_lastKeyframePts; // 本次连续读取中上一个关键帧, 微秒
 
 public:
     // 获取上一帧
     FFrame *getLastVFrame();
+    // 阻塞到有待显示的帧, 退出或视频已播完时返回false
+    bool waitVFrame();
     // 获取当前帧
     FFrame *getVFrame();
     // 获取下一帧
@@ -120,9 +301,95 @@ public:
     void setNextVFrame();
 
 private:
-    void packetQueueFlush(FPacketQueue *queue);
+    void packetQueueFlush(FPacketQueue *queue, int64_t seekTarget, int64_t requestTime);
+    // 取出队首的包, destPkt为空时直接丢弃, 同时归还内存预算
+    void packetQueuePop(FPacketQueue *queue, AVPacket *destPkt);
+    bool packetQueueEnough(const FPacketQueue *queue) const;
+    bool packetQueueAccept(const FPacketQueue *queue) const;
     void pushPacket(FPacketQueue *queue, AVPacket *pkt);
     int getPacket(FPacketQueue *queue, AVPacket* destPkt, FPktDecoder *decoder);
+    // 跳转后丢弃目标时间之前的帧, 返回false表示frame应丢弃
+    bool passSeekTarget(FPktDecoder *decoder, AVFrame *frame, int streamIndex);
+    // 送包前根据与跳转目标的距离切换降级解码
+    void updateSeekSkip(FPktDecoder *decoder, const AVPacket *pkt, int streamIndex);
+    // 查找并打开解码器, 可在任意线程中调用
+    bool openCodec(FPktDecoder *decoder, int streamIndex, bool isVideo);
+    // 等待异步打开解码器的任务结束, 之后才能释放解码器
+    void waitCodecOpen();
+    // 按策略期望的解码线程数, 未指定时为CODEC_MAX_AUTO_THREADS
+    int wantedThreads(bool isVideo) const;
+    // 打开解码器前设置线程数/线程类型
+    void applyThreadingPolicy(FPktDecoder *decoder, bool isVideo);
+    // 关键帧索引能确定目标所在的GOP且格式支持时按字节偏移跳转, 否则按时间跳转
+    int seekStream(int64_t target);
+    // TS, 以及没有关键帧表的FLV, 按时间跳转需要逐段读取时间戳, 改用估算的字节位置
+    bool useEstimatedSeek() const;
+    /**
+     * @brief 按已知关键帧之间的码率插值估算目标的字节位置, 向后扫描到关键帧后修正估算,
+     * 直到找到目标所在的GOP, 扫描到的关键帧记入关键帧索引, 之后在附近跳转可以直接定位
+     * @return 找到时返回>=0, 无法估算返回AVERROR(ENOSYS), 由调用方退回按时间跳转
+     */
+    int seekByEstimate(int64_t target);
+    // 按目标前后最近的锚点插值, 没有关键帧时以文件首尾或容器码率为锚点
+    int64_t estimateBytePos(int64_t target) const;
+    // 记录读到的视频关键帧
+    void recordKeyframe(const AVPacket *pkt);
+    // 直播时移下的跳转: 目标早于录制末尾时改为从录制文件读取, 否则回到直播, live返回是否回到了直播
+    int seekTimeshift(int64_t target, bool *live);
+    int openTimeshiftInput();
+    // 改为读取录制文件, 直播输入交给采集线程继续录制
+    void enterTimeshift();
+    // 停止采集线程, demux重新读取直播输入
+    void leaveTimeshift();
+    void captureLive();
+    // 录制文件中的包转换为直播输入的流序号和时间基, 不是音视频流时返回false
+    bool mapTimeshiftPacket(AVPacket *pkt);
+    static int captureInterruptCallback(void *opaque);
+
+    // 阻塞IO的中断: 退出, 读包期间有新的跳转请求, 或当前操作超时
+    enum IoOp{
+        IO_NONE,
+        IO_OPEN,
+        IO_READ,
+        IO_SEEK
+    };
+    static int ioInterruptCallback(void *opaque);
+    void beginIo(IoOp op, int64_t timeout);
+    // 结束计时并记录统计, 返回耗时(ms)
+    double endIo(int errNum);
+
+    IoOp m_ioOp; // 以下IO状态只在发起IO的线程及其中断回调中访问
+    int64_t m_ioStart;
+    int64_t m_ioDeadline;
+    int m_ioSeekSerial;
+    bool m_ioTimedOut;
+    std::atomic<int64_t> m_openTimeout; // 微秒
+    std::atomic<int64_t> m_readTimeout;
+    mutable std::mutex m_metricsMutex;
+    IoMetrics m_ioMetrics;
+    // 自定义IO, 需在m_pAvFormatCtx关闭后释放
+    std::unique_ptr<IOSource> m_ioSource;
+    std::atomic<int64_t> m_mappedIoWindow;
+    std::atomic<int64_t> m_readAheadDepth;
+    std::atomic_int m_readAheadChunk;
+    ReadAheadSource *m_readAhead; // 指向m_ioSource, 受m_metricsMutex保护
+    HttpSource *m_httpSource; // 同上, 可能被m_readAhead包装
+    std::atomic_bool m_httpDiskCache;
+    std::atomic<int64_t> m_probeSize;
+    std::atomic<int64_t> m_analyzeDuration; // 微秒
+    std::atomic_bool m_streamInfoCache;
+
+    // 直播时移
+    std::atomic_bool m_timeshift;
+    std::atomic<int64_t> m_timeshiftWindow; // 微秒
+    TimeshiftRecorder m_recorder;
+    // 以下仅demux线程访问
+    bool m_shifted; // 正在读取录制文件
+    AVFormatContext *m_shiftCtx;
+    std::unique_ptr<TimeshiftSource> m_shiftSource; // 需在m_shiftCtx关闭后释放
+    // 时移期间读取直播输入并写入录制, 与demux线程不同时访问m_pAvFormatCtx
+    PipelineThreads m_captureThread;
+    std::atomic_bool m_captureStop;
 
 };
 
@@ -0,0 +1,112 @@
+#include "FrameBufferPool.h"
+#include <QsLog.h>
+#include <algorithm>
+#include <iterator>
+
+extern "C"{
+#include <libavutil/imgutils.h>
+#include <libavutil/mem.h>
+}
+
+FrameBufferPool::~FrameBufferPool()
+{
+    clear();
+}
+
+bool FrameBufferPool::getBuffer(AVFrame *frame)
+{
+    AVPixelFormat format = (AVPixelFormat)frame->format;
+    int size = av_image_get_buffer_size(format, frame->width, frame->height, FRAME_POOL_ALIGN);
+    if(size <= 0){
+        QLOG_ERROR() << "invalid frame buffer parameters:" << frame->format << frame->width << frame->height;
+        return false;
+    }
+
+    uint8_t *data = nullptr;
+    Bucket *bucket = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = std::find_if(m_buckets.begin(), m_buckets.end(), [&](const Bucket& b){
+            return b.format == frame->format && b.width == frame->width && b.height == frame->height;
+        });
+        if(it == m_buckets.end()){
+            m_buckets.push_back(Bucket{this, frame->format, frame->width, frame->height, size, {}});
+            it = std::prev(m_buckets.end());
+        }
+        bucket = &*it;
+        if(m_current != bucket){
+            // 尺寸或格式变化, 之前的缓冲不会再被取用
+            for(Bucket& other : m_buckets){
+                if(&other != bucket) freeIdle(other);
+            }
+            m_current = bucket;
+        }
+        if(!bucket->idle.empty()){
+            data = bucket->idle.back();
+            bucket->idle.pop_back();
+            m_stats.hits++;
+            m_stats.idleBytes -= bucket->size;
+        }
+        else{
+            m_stats.misses++;
+        }
+        m_stats.outstanding++;
+        m_stats.peakOutstanding = std::max(m_stats.peakOutstanding, m_stats.outstanding);
+    }
+
+    if(!data){
+        data = static_cast<uint8_t*>(av_malloc(size));
+    }
+    AVBufferRef *buf = data ? av_buffer_create(data, size, &FrameBufferPool::releaseBuffer, bucket, 0) : nullptr;
+    if(!buf){
+        av_free(data);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stats.outstanding--;
+        QLOG_ERROR() << "alloc frame buffer fail:" << size << "bytes";
+        return false;
+    }
+    frame->buf[0] = buf;
+    av_image_fill_arrays(frame->data, frame->linesize, data, format, frame->width, frame->height, FRAME_POOL_ALIGN);
+    frame->extended_data = frame->data;
+    return true;
+}
+
+FrameBufferPool::Stats FrameBufferPool::stats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+void FrameBufferPool::clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for(Bucket& bucket : m_buckets){
+        freeIdle(bucket);
+    }
+    m_current = nullptr;
+}
+
+void FrameBufferPool::releaseBuffer(void *opaque, uint8_t *data)
+{
+    Bucket *bucket = static_cast<Bucket*>(opaque);
+    FrameBufferPool *pool = bucket->pool;
+    {
+        std::lock_guard<std::mutex> lock(pool->m_mutex);
+        pool->m_stats.outstanding--;
+        if(bucket == pool->m_current && (int)bucket->idle.size() < FRAME_POOL_MAX_IDLE){
+            bucket->idle.push_back(data);
+            pool->m_stats.idleBytes += bucket->size;
+            return;
+        }
+    }
+    av_free(data); // 已不是当前尺寸, 或空闲缓冲已够用
+}
+
+void FrameBufferPool::freeIdle(Bucket &bucket)
+{
+    for(uint8_t *data : bucket.idle){
+        av_free(data);
+    }
+    m_stats.idleBytes -= (int64_t)bucket.size * bucket.idle.size();
+    bucket.idle.clear();
+}
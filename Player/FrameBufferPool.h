@@ -0,0 +1,68 @@
+#ifndef FRAMEBUFFERPOOL_H
+#define FRAMEBUFFERPOOL_H
+
+#include <list>
+#include <vector>
+#include <mutex>
+#include "ThreadPool.h"
+
+extern "C"{
+#include <libavutil/frame.h>
+}
+
+// 每种尺寸/格式最多保留的空闲缓冲数量, 渲染端同时持有的帧不超过这个数
+#define FRAME_POOL_MAX_IDLE 4
+// 行字节数和缓冲起点的对齐, 与av_frame_get_buffer一致
+#define FRAME_POOL_ALIGN 64
+
+/**
+ * @brief 送往渲染端的转换帧的缓冲复用池
+ * 按格式和宽高分桶, 缓冲以AVBufferRef交给AVFrame, 最后一个引用释放时(通常在GUI线程)回到所属的桶
+ * 尺寸或格式变化时释放其他桶的空闲缓冲, 长时间播放不会反复申请释放大块内存
+ */
+class FrameBufferPool : public ForbidCopy
+{
+public:
+    struct Stats{
+        int64_t hits = 0; // 复用空闲缓冲的次数
+        int64_t misses = 0; // 新申请缓冲的次数
+        int outstanding = 0; // 正被帧引用的缓冲数
+        int peakOutstanding = 0;
+        int64_t idleBytes = 0; // 池中空闲缓冲的总大小
+    };
+
+    static FrameBufferPool& instance()
+    {
+        static FrameBufferPool ins;
+        return ins;
+    }
+    ~FrameBufferPool();
+
+    // 按frame->format/width/height为帧分配缓冲, 失败返回false
+    bool getBuffer(AVFrame *frame);
+    Stats stats() const;
+    // 释放所有空闲缓冲, 正被引用的缓冲归还时直接释放
+    void clear();
+
+private:
+    FrameBufferPool() = default;
+
+    struct Bucket{
+        FrameBufferPool *pool;
+        int format;
+        int width;
+        int height;
+        int size;
+        std::vector<uint8_t*> idle;
+    };
+    static void releaseBuffer(void *opaque, uint8_t *data);
+    void freeIdle(Bucket& bucket);
+
+    mutable std::mutex m_mutex;
+    // 缓冲的释放回调持有桶的地址, 桶只增不删
+    std::list<Bucket> m_buckets;
+    Bucket *m_current = nullptr; // 最近使用的桶
+    Stats m_stats;
+};
+
+#endif // FRAMEBUFFERPOOL_H
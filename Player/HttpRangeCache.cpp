@@ -0,0 +1,161 @@
+#include "HttpRangeCache.h"
+#include "Utils.h"
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QsLog.h>
+#include <algorithm>
+
+HttpRangeCache::HttpRangeCache()
+    : m_totalSize(0),
+      m_fileIndex(-1)
+{
+}
+
+HttpRangeCache::~HttpRangeCache()
+{
+    close();
+}
+
+bool HttpRangeCache::open(const QString &url, const QByteArray &validator, int64_t totalSize)
+{
+    close();
+    QString dirPath = Utils::cacheFilePath("http", url + "\n" + QString::fromLatin1(validator), "d");
+    if(dirPath.isEmpty() || !Utils::mkDirs(dirPath)){
+        QLOG_ERROR() << "create http cache dir fail";
+        return false;
+    }
+    m_dir = dirPath;
+    m_totalSize = totalSize;
+    int64_t count = (totalSize + HTTP_CACHE_SEGMENT - 1) / HTTP_CACHE_SEGMENT;
+    m_present.assign((size_t)count, false);
+
+    // 只登记长度完整的分段, 写了一半的分段由QSaveFile保证不会出现
+    int cached = 0;
+    QDir dir(m_dir);
+    QFileInfoList segments = dir.entryInfoList(QStringList() << "*.seg", QDir::Files);
+    for(const QFileInfo& info : segments){
+        bool ok = false;
+        int64_t index = info.completeBaseName().toLongLong(&ok);
+        if(!ok || index < 0 || index >= count || info.size() != segmentLength(index)) continue;
+        m_present[(size_t)index] = true;
+        cached++;
+    }
+
+    // 更新目录的修改时间, 作为淘汰依据
+    QSaveFile meta(dir.filePath("meta"));
+    if(meta.open(QIODevice::WriteOnly)){
+        meta.write(url.toUtf8() + "\n" + validator + "\n");
+        meta.commit();
+    }
+    // 按url记录最近的校验值和长度, 下次打开时不必先请求服务器
+    QString indexPath = Utils::cacheFilePath("http-meta", url, "meta");
+    QSaveFile index(indexPath);
+    if(!indexPath.isEmpty() && index.open(QIODevice::WriteOnly)){
+        index.write(validator + "\n" + QByteArray::number(totalSize) + "\n");
+        index.commit();
+    }
+    QLOG_INFO() << "http cache:" << cached << "/" << count << "segments cached";
+    trim(HTTP_CACHE_MAX_BYTES, m_dir);
+    return true;
+}
+
+void HttpRangeCache::close()
+{
+    if(m_file.isOpen()){
+        m_file.close();
+    }
+    m_fileIndex = -1;
+    m_dir.clear();
+    m_present.clear();
+    m_totalSize = 0;
+}
+
+bool HttpRangeCache::isComplete() const
+{
+    return isOpen() && std::all_of(m_present.begin(), m_present.end(), [](bool present){return present;});
+}
+
+bool HttpRangeCache::lookup(const QString &url, QByteArray *validator, int64_t *totalSize)
+{
+    QString indexPath = Utils::cacheFilePath("http-meta", url, "meta");
+    QFile index(indexPath);
+    if(indexPath.isEmpty() || !index.open(QIODevice::ReadOnly)) return false;
+    QList<QByteArray> lines = index.readAll().split('\n');
+    if(lines.size() < 2 || lines.at(0).isEmpty()) return false;
+    bool ok = false;
+    int64_t size = lines.at(1).toLongLong(&ok);
+    if(!ok || size <= 0) return false;
+    *validator = lines.at(0);
+    *totalSize = size;
+    return true;
+}
+
+bool HttpRangeCache::hasSegment(int64_t index) const
+{
+    return index >= 0 && index < (int64_t)m_present.size() && m_present[(size_t)index];
+}
+
+int HttpRangeCache::read(int64_t index, int64_t offset, uint8_t *buf, int size)
+{
+    if(!hasSegment(index)) return -1;
+    if(m_fileIndex != index){
+        if(m_file.isOpen()){
+            m_file.close();
+        }
+        m_fileIndex = -1;
+        m_file.setFileName(segmentPath(index));
+        if(!m_file.open(QIODevice::ReadOnly)){
+            m_present[(size_t)index] = false; // 被淘汰或删除, 重新下载
+            return -1;
+        }
+        m_fileIndex = index;
+    }
+    if(!m_file.seek(offset)) return -1;
+    qint64 len = m_file.read((char*)buf, std::min<int64_t>(size, segmentLength(index) - offset));
+    return len > 0 ? (int)len : -1;
+}
+
+bool HttpRangeCache::write(int64_t index, const uint8_t *data, int size)
+{
+    if(!isOpen() || index < 0 || index >= (int64_t)m_present.size() || size != segmentLength(index)) return false;
+    QSaveFile file(segmentPath(index));
+    if(!file.open(QIODevice::WriteOnly) || file.write((const char*)data, size) != size || !file.commit()){
+        QLOG_ERROR() << "write http cache segment fail:" << file.errorString();
+        return false;
+    }
+    m_present[(size_t)index] = true;
+    return true;
+}
+
+void HttpRangeCache::trim(int64_t maxBytes, const QString &keep)
+{
+    if(keep.isEmpty()) return;
+    // 最近使用的在前
+    QDir root(QFileInfo(keep).absolutePath());
+    QFileInfoList entries = root.entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot, QDir::Time);
+    int64_t total = 0;
+    for(const QFileInfo& entry : entries){
+        int64_t size = 0;
+        QFileInfoList files = QDir(entry.absoluteFilePath()).entryInfoList(QDir::Files);
+        for(const QFileInfo& file : files){
+            size += file.size();
+        }
+        total += size;
+        if(total > maxBytes && entry.absoluteFilePath() != QFileInfo(keep).absoluteFilePath()){
+            QLOG_INFO() << "evict http cache:" << entry.fileName() << size << "bytes";
+            QDir(entry.absoluteFilePath()).removeRecursively();
+            total -= size;
+        }
+    }
+}
+
+int64_t HttpRangeCache::segmentLength(int64_t index) const
+{
+    return std::min<int64_t>(HTTP_CACHE_SEGMENT, m_totalSize - index * HTTP_CACHE_SEGMENT);
+}
+
+QString HttpRangeCache::segmentPath(int64_t index) const
+{
+    return QString("%1/%2.seg").arg(m_dir).arg(index);
+}
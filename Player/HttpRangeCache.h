@@ -0,0 +1,55 @@
+#ifndef HTTPRANGECACHE_H
+#define HTTPRANGECACHE_H
+
+#include <QString>
+#include <QByteArray>
+#include <QFile>
+#include <vector>
+#include "ThreadPool.h"
+
+// 缓存分段大小, 也是HttpSource每次请求的范围
+#define HTTP_CACHE_SEGMENT (1024 * 1024)
+// 磁盘缓存总大小上限, 超出时按最近使用时间淘汰整个资源
+#define HTTP_CACHE_MAX_BYTES (1024LL * 1024 * 1024)
+
+/**
+ * @brief HTTP资源的分段磁盘缓存
+ * 以URL和ETag(没有时用Last-Modified或长度)为键, 每个资源一个目录, 每段一个文件,
+ * 资源在服务器上变化后键也随之变化, 不会读到旧数据
+ * 只在HttpSource所在的线程中使用
+ */
+class HttpRangeCache : public ForbidCopy
+{
+public:
+    HttpRangeCache();
+    ~HttpRangeCache();
+
+    // 打开url对应的缓存目录并登记已有的分段, 之后淘汰超出上限的其他资源
+    bool open(const QString& url, const QByteArray& validator, int64_t totalSize);
+    void close();
+    inline bool isOpen() const {return !m_dir.isEmpty();}
+    // 所有分段都已缓存
+    bool isComplete() const;
+
+    bool hasSegment(int64_t index) const;
+    // 读取第index段offset处开始的数据, 返回读到的字节数, 失败返回-1
+    int read(int64_t index, int64_t offset, uint8_t *buf, int size);
+    bool write(int64_t index, const uint8_t *data, int size);
+
+    // 在keep所在的缓存根目录中按最近使用时间淘汰, 直到总大小不超过maxBytes, keep本身不淘汰
+    static void trim(int64_t maxBytes, const QString& keep);
+    // 上次open()时记录的url的校验值和总长度, 用于离线或不经网络确认直接打开缓存
+    static bool lookup(const QString& url, QByteArray *validator, int64_t *totalSize);
+
+private:
+    int64_t segmentLength(int64_t index) const;
+    QString segmentPath(int64_t index) const;
+
+    QString m_dir;
+    int64_t m_totalSize;
+    std::vector<bool> m_present;
+    QFile m_file; // 当前读取的分段
+    int64_t m_fileIndex;
+};
+
+#endif // HTTPRANGECACHE_H
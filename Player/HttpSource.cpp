@@ -0,0 +1,374 @@
+#include "HttpSource.h"
+#include <QsLog.h>
+#include <QList>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <algorithm>
+
+extern "C"{
+#include <libavformat/avformat.h>
+#include <libavutil/error.h>
+#include <libavutil/time.h>
+#include <libavutil/dict.h>
+}
+
+// 状态行/响应头单行长度上限
+#define HTTP_MAX_LINE 8192
+
+HttpSource::HttpSource(bool diskCache)
+    : m_useDiskCache(diskCache),
+      m_conn(nullptr),
+      m_segmentIndex(-1),
+      m_segmentLength(0),
+      m_pos(0),
+      m_size(-1),
+      m_deadline(0),
+      m_abort(false),
+      m_networkBytes(0),
+      m_cacheBytes(0),
+      m_requests(0)
+{
+}
+
+HttpSource::~HttpSource()
+{
+    freeAVIOContext();
+    close();
+}
+
+bool HttpSource::isHttpUrl(const QString &url)
+{
+    QString scheme = QUrl(url).scheme().toLower();
+    return scheme == "http" || scheme == "https";
+}
+
+bool HttpSource::open(const QString &url)
+{
+    close();
+    m_abort.store(false);
+    m_url = QUrl(url);
+    m_segment.resize(HTTP_CACHE_SEGMENT);
+    m_segmentIndex = -1;
+    m_pos = 0;
+
+    // 总是向服务器确认, 同一地址的内容可能已更换; 校验值一致时下面打开的就是原有缓存
+    // 确认失败时沿用缓存记录的长度和校验值, 缺失的分段下载时再校验
+    QByteArray cachedValidator;
+    int64_t cachedSize = -1;
+    bool cached = m_useDiskCache && HttpRangeCache::lookup(url, &cachedValidator, &cachedSize);
+    m_deadline = av_gettime_relative() + (int64_t)(HTTP_PROBE_TIMEOUT * 1000000);
+    bool probed = probe(&m_size, &m_validator);
+    m_deadline = 0;
+    if(!probed){
+        if(!cached){
+            m_size = -1;
+            return false;
+        }
+        disconnect(); // 超时中断的连接不再复用
+        m_size = cachedSize;
+        m_validator = cachedValidator;
+    }
+    if(m_useDiskCache){
+        m_cache.open(url, m_validator, m_size); // 失败时只是不缓存
+    }
+    QLOG_INFO() << "http source opened:" << m_size << "bytes, validator" << m_validator.constData()
+                << (probed ? "" : "(revalidation fail, cached metadata)")
+                << (m_cache.isComplete() ? "(fully cached)" : "");
+    return true;
+}
+
+bool HttpSource::probe(int64_t *size, QByteArray *validator)
+{
+    // 请求第一个字节, 确认支持范围请求并拿到总长度和ETag
+    Response response;
+    uint8_t first = 0;
+    if(!request(0, 0, &response)) return false;
+    if(response.status != 206 || response.totalSize <= 0){
+        QLOG_INFO() << "http range request not supported, status" << response.status;
+        disconnect();
+        return false;
+    }
+    if(!readBody(response, &first, 1)){
+        disconnect();
+        return false;
+    }
+    *size = response.totalSize;
+    *validator = !response.etag.isEmpty() ? response.etag
+               : !response.lastModified.isEmpty() ? response.lastModified : QByteArray::number(*size);
+    return true;
+}
+
+void HttpSource::close()
+{
+    disconnect();
+    m_cache.close();
+    m_validator.clear();
+    m_segmentIndex = -1;
+    m_segmentLength = 0;
+    m_pos = 0;
+    m_size = -1;
+}
+
+void HttpSource::interrupt()
+{
+    m_abort.store(true);
+}
+
+HttpSource::Stats HttpSource::stats() const
+{
+    Stats stats;
+    stats.networkBytes = m_networkBytes.load();
+    stats.cacheBytes = m_cacheBytes.load();
+    stats.requests = m_requests.load();
+    return stats;
+}
+
+int HttpSource::read(uint8_t *buf, int size)
+{
+    if(m_pos >= m_size) return AVERROR_EOF;
+    int64_t index = m_pos / HTTP_CACHE_SEGMENT;
+    int64_t offset = m_pos - index * HTTP_CACHE_SEGMENT;
+    if(index != m_segmentIndex){
+        if(m_cache.hasSegment(index)){
+            int len = m_cache.read(index, offset, buf, size);
+            if(len > 0){
+                m_pos += len;
+                m_cacheBytes.fetch_add(len);
+                return len;
+            }
+        }
+        if(!fetchSegment(index)){
+            return m_abort.load() ? AVERROR_EXIT : AVERROR(EIO);
+        }
+    }
+    int len = (int)std::min<int64_t>(size, m_segmentLength - offset);
+    memcpy(buf, m_segment.data() + offset, len);
+    m_pos += len;
+    return len;
+}
+
+int64_t HttpSource::seek(int64_t offset, int whence)
+{
+    int64_t pos = 0;
+    switch(whence){
+    case SEEK_SET: pos = offset; break;
+    case SEEK_CUR: pos = m_pos + offset; break;
+    case SEEK_END: pos = m_size + offset; break;
+    default: return AVERROR(EINVAL);
+    }
+    if(pos < 0) return AVERROR(EINVAL);
+    m_pos = pos; // 只移动位置, 读取时再按段请求
+    return m_pos;
+}
+
+bool HttpSource::fetchSegment(int64_t index)
+{
+    int64_t start = index * HTTP_CACHE_SEGMENT;
+    int length = (int)std::min<int64_t>(HTTP_CACHE_SEGMENT, m_size - start);
+    for(int attempt = 0; attempt <= HTTP_FETCH_RETRIES && !m_abort.load(); attempt++){
+        Response response;
+        if(!request(start, start + length - 1, &response)) continue;
+        if(response.status != 206){
+            QLOG_ERROR() << "http range request fail, status" << response.status;
+            disconnect();
+            return false;
+        }
+        QByteArray validator = !response.etag.isEmpty() ? response.etag
+                             : !response.lastModified.isEmpty() ? response.lastModified : QByteArray::number(m_size);
+        if(validator != m_validator){
+            QLOG_ERROR() << "http resource changed while playing";
+            disconnect();
+            return false;
+        }
+        if(!readBody(response, m_segment.data(), length)){
+            disconnect(); // 连接中断, 重新连接后重试
+            continue;
+        }
+        m_segmentIndex = index;
+        m_segmentLength = length;
+        m_networkBytes.fetch_add(length);
+        if(m_cache.isOpen()){
+            m_cache.write(index, m_segment.data(), length);
+        }
+        return true;
+    }
+    QLOG_ERROR() << "fetch http segment fail:" << index;
+    return false;
+}
+
+bool HttpSource::request(int64_t start, int64_t end, Response *response)
+{
+    for(int redirect = 0; redirect <= HTTP_MAX_REDIRECTS; redirect++){
+        if(!connectTo(m_url)) return false;
+
+        QByteArray path = m_url.path(QUrl::FullyEncoded).toLatin1();
+        if(path.isEmpty()) path = "/";
+        if(m_url.hasQuery()){
+            path += "?" + m_url.query(QUrl::FullyEncoded).toLatin1();
+        }
+        QByteArray host = m_url.host(QUrl::FullyEncoded).toLatin1();
+        if(m_url.port() > 0){
+            host += ":" + QByteArray::number(m_url.port());
+        }
+        char range[64];
+        snprintf(range, sizeof(range), "bytes=%lld-%lld", (long long)start, (long long)end);
+        QByteArray head = "GET " + path + " HTTP/1.1\r\n"
+                        + "Host: " + host + "\r\n"
+                        + "Range: " + range + "\r\n"
+                        + "User-Agent: " LIBAVFORMAT_IDENT "\r\n"
+                        + "Accept: */*\r\n"
+                        + "Connection: keep-alive\r\n\r\n";
+        avio_write(m_conn, (const unsigned char*)head.constData(), head.size());
+        avio_flush(m_conn);
+        m_requests.fetch_add(1);
+
+        // 状态行, 例如 HTTP/1.1 206 Partial Content
+        QByteArray line;
+        if(m_conn->error < 0 || !readLine(&line)){
+            disconnect(); // 保持的连接可能已被服务器关闭
+            return false;
+        }
+        QList<QByteArray> parts = line.split(' ');
+        if(parts.size() < 2 || !parts.at(0).startsWith("HTTP/")){
+            QLOG_ERROR() << "invalid http status line";
+            disconnect();
+            return false;
+        }
+        *response = Response();
+        response->status = parts.at(1).toInt();
+        response->keepAlive = parts.at(0) != "HTTP/1.0";
+
+        bool ok = false;
+        while((ok = readLine(&line)) && !line.isEmpty()){
+            int colon = line.indexOf(':');
+            if(colon <= 0) continue;
+            QByteArray name = line.left(colon).trimmed().toLower();
+            QByteArray value = line.mid(colon + 1).trimmed();
+            if(name == "content-length"){
+                response->contentLength = value.toLongLong();
+            }
+            else if(name == "content-range"){ // bytes 0-0/12345, 总长度未知时为*
+                int slash = value.lastIndexOf('/');
+                bool known = false;
+                int64_t total = slash >= 0 ? value.mid(slash + 1).toLongLong(&known) : -1;
+                if(known) response->totalSize = total;
+            }
+            else if(name == "etag"){
+                response->etag = value;
+            }
+            else if(name == "last-modified"){
+                response->lastModified = value;
+            }
+            else if(name == "location"){
+                response->location = value;
+            }
+            else if(name == "connection"){
+                response->keepAlive = value.toLower() != "close";
+            }
+            else if(name == "transfer-encoding"){
+                response->chunked = value.toLower().contains("chunked");
+            }
+        }
+        if(!ok){
+            disconnect();
+            return false;
+        }
+
+        bool redirected = response->status == 301 || response->status == 302 || response->status == 303
+                || response->status == 307 || response->status == 308;
+        if(redirected && !response->location.isEmpty()){
+            disconnect(); // 不读取重定向的响应体
+            m_url = m_url.resolved(QUrl(QString::fromLatin1(response->location)));
+            continue;
+        }
+        return true;
+    }
+    QLOG_ERROR() << "too many http redirects";
+    return false;
+}
+
+bool HttpSource::readBody(const Response &response, uint8_t *buf, int64_t length)
+{
+    if(response.chunked){
+        // 每块: 十六进制长度行, 数据, 空行; 长度为0的块结束
+        QByteArray line;
+        int64_t got = 0;
+        while(true){
+            if(!readLine(&line)) return false;
+            int64_t chunk = strtoll(line.constData(), nullptr, 16);
+            if(chunk <= 0) break;
+            if(got + chunk > length) return false;
+            if(avio_read(m_conn, buf + got, (int)chunk) != chunk) return false;
+            got += chunk;
+            if(!readLine(&line)) return false;
+        }
+        while(readLine(&line) && !line.isEmpty()){} // 跳过trailer
+        if(got != length) return false;
+    }
+    else{
+        if(response.contentLength >= 0 && response.contentLength != length) return false;
+        int64_t got = 0;
+        while(got < length){
+            int len = avio_read(m_conn, buf + got, (int)std::min<int64_t>(length - got, INT_MAX));
+            if(len <= 0) return false;
+            got += len;
+        }
+    }
+    if(!response.keepAlive){
+        disconnect();
+    }
+    return true;
+}
+
+bool HttpSource::connectTo(const QUrl &url)
+{
+    bool https = url.scheme().toLower() == "https";
+    int port = url.port(https ? 443 : 80);
+    QString host = QString("%1://%2:%3").arg(https ? "tls" : "tcp").arg(url.host(QUrl::FullyEncoded)).arg(port);
+    if(m_conn && host == m_connHost) return true;
+    disconnect();
+
+    AVIOInterruptCB callback = {&HttpSource::interruptCallback, this};
+    AVDictionary *opts = nullptr;
+    av_dict_set_int(&opts, "rw_timeout", (int64_t)(HTTP_IO_TIMEOUT * 1000000), 0);
+    int ret = avio_open2(&m_conn, host.toUtf8().constData(), AVIO_FLAG_READ_WRITE, &callback, &opts);
+    av_dict_free(&opts);
+    if(ret < 0){
+        char errBuf[AV_ERROR_MAX_STRING_SIZE] = {0};
+        av_strerror(ret, errBuf, sizeof(errBuf));
+        QLOG_ERROR() << "http connect fail:" << host << errBuf;
+        m_conn = nullptr;
+        return false;
+    }
+    m_connHost = host;
+    return true;
+}
+
+void HttpSource::disconnect()
+{
+    if(m_conn){
+        avio_closep(&m_conn);
+    }
+    m_connHost.clear();
+}
+
+bool HttpSource::readLine(QByteArray *line)
+{
+    line->clear();
+    while(true){
+        int c = avio_r8(m_conn);
+        if(avio_feof(m_conn) || m_conn->error < 0) return false;
+        if(c == '\n') return true;
+        if(c != '\r') line->append((char)c);
+        if(line->size() > HTTP_MAX_LINE) return false;
+    }
+}
+
+int HttpSource::interruptCallback(void *opaque)
+{
+    HttpSource *source = static_cast<HttpSource*>(opaque);
+    if(source->m_abort.load()) return 1;
+    return source->m_deadline > 0 && av_gettime_relative() > source->m_deadline ? 1 : 0;
+}
@@ -0,0 +1,94 @@
+#ifndef HTTPSOURCE_H
+#define HTTPSOURCE_H
+
+#include <QUrl>
+#include <QByteArray>
+#include <atomic>
+#include <vector>
+#include "IOSource.h"
+#include "HttpRangeCache.h"
+
+// 连接/单次读写超时(秒)
+#define HTTP_IO_TIMEOUT 10.0
+// 打开时向服务器确认长度和校验值的总时限(秒), 超时按离线处理
+#define HTTP_PROBE_TIMEOUT 3.0
+#define HTTP_MAX_REDIRECTS 5
+// 下载一段失败时的重试次数, 保持连接被服务器关闭时也靠重试恢复
+#define HTTP_FETCH_RETRIES 2
+
+/**
+ * @brief 支持范围请求的HTTP(S)数据源
+ * 按HTTP_CACHE_SEGMENT分段请求, 下载的分段写入磁盘缓存, 之后的跳转和重播直接读本地
+ * 连接通过libavformat的tcp/tls协议建立, 请求和响应头自己处理, 以便拿到ETag
+ * 服务器不支持范围请求或长度未知时open()失败, 由调用方退回libavformat的http协议
+ * open()总是先向服务器确认, 校验值一致时复用缓存; 确认失败时沿用缓存记录的长度和校验值, 离线也能重播
+ * read()/seek()只在一个线程中调用, interrupt()可在任意线程调用
+ */
+class HttpSource : public IOSource
+{
+public:
+    struct Stats{
+        int64_t networkBytes = 0; // 从网络下载的字节数
+        int64_t cacheBytes = 0; // 从磁盘缓存读取的字节数
+        int requests = 0;
+    };
+
+    explicit HttpSource(bool diskCache = true);
+    ~HttpSource();
+
+    static bool isHttpUrl(const QString& url);
+
+    bool open(const QString& url) override;
+    void close() override;
+    int read(uint8_t *buf, int size) override;
+    int64_t seek(int64_t offset, int whence) override;
+    inline int64_t size() const override {return m_size;}
+    void interrupt() override;
+
+    Stats stats() const;
+
+private:
+    struct Response{
+        int status = 0;
+        int64_t contentLength = -1;
+        int64_t totalSize = -1; // Content-Range中的总长度
+        QByteArray etag;
+        QByteArray lastModified;
+        QByteArray location;
+        bool keepAlive = true;
+        bool chunked = false;
+    };
+
+    // 请求第一个字节, 拿到总长度和校验值(ETag/Last-Modified/长度)
+    bool probe(int64_t *size, QByteArray *validator);
+    // 请求[start, end]并解析响应头, 跟随重定向, 之后由readBody()读取响应体
+    bool request(int64_t start, int64_t end, Response *response);
+    bool readBody(const Response& response, uint8_t *buf, int64_t length);
+    bool connectTo(const QUrl& url);
+    void disconnect();
+    bool readLine(QByteArray *line);
+    // 下载第index段到m_segment, 成功后写入磁盘缓存
+    bool fetchSegment(int64_t index);
+    static int interruptCallback(void *opaque);
+
+    const bool m_useDiskCache;
+    QUrl m_url; // 重定向之后的地址
+    QString m_connHost; // 当前连接的scheme://host:port, 相同时复用
+    AVIOContext *m_conn;
+    QByteArray m_validator;
+    HttpRangeCache m_cache;
+
+    std::vector<uint8_t> m_segment;
+    int64_t m_segmentIndex;
+    int m_segmentLength;
+    int64_t m_pos;
+    int64_t m_size;
+    int64_t m_deadline; // av_gettime_relative()微秒, 超过后中断网络操作, 0表示不限
+
+    std::atomic_bool m_abort;
+    std::atomic<int64_t> m_networkBytes;
+    std::atomic<int64_t> m_cacheBytes;
+    std::atomic_int m_requests;
+};
+
+#endif // HTTPSOURCE_H
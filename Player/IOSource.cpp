@@ -0,0 +1,51 @@
+#include "IOSource.h"
+#include <QsLog.h>
+
+extern "C"{
+#include <libavutil/mem.h>
+#include <libavutil/error.h>
+}
+
+IOSource::~IOSource()
+{
+    freeAVIOContext();
+}
+
+AVIOContext *IOSource::avioContext(int bufferSize)
+{
+    if(m_avio) return m_avio;
+    uint8_t *buffer = (uint8_t*)av_malloc(bufferSize);
+    if(!buffer){
+        QLOG_ERROR() << "av_malloc avio buffer fail";
+        return nullptr;
+    }
+    m_avio = avio_alloc_context(buffer, bufferSize, 0, this, &IOSource::readPacket, nullptr, &IOSource::seekPacket);
+    if(!m_avio){
+        av_free(buffer);
+        QLOG_ERROR() << "avio_alloc_context fail";
+        return nullptr;
+    }
+    return m_avio;
+}
+
+void IOSource::freeAVIOContext()
+{
+    if(!m_avio) return;
+    av_freep(&m_avio->buffer); // 缓冲区可能已被libavformat重新分配
+    avio_context_free(&m_avio);
+}
+
+int IOSource::readPacket(void *opaque, uint8_t *buf, int size)
+{
+    return static_cast<IOSource*>(opaque)->read(buf, size);
+}
+
+int64_t IOSource::seekPacket(void *opaque, int64_t offset, int whence)
+{
+    IOSource *source = static_cast<IOSource*>(opaque);
+    if(whence & AVSEEK_SIZE){
+        int64_t size = source->size();
+        return size >= 0 ? size : AVERROR(ENOSYS);
+    }
+    return source->seek(offset, whence & ~AVSEEK_FORCE);
+}
@@ -0,0 +1,49 @@
+#ifndef IOSOURCE_H
+#define IOSOURCE_H
+
+#include <QString>
+#include <cstdint>
+#include "ThreadPool.h"
+
+extern "C"{
+#include <libavformat/avio.h>
+}
+
+// AVIOContext内部缓冲区大小
+#define IO_SOURCE_BUFFER_SIZE (256 * 1024)
+
+/**
+ * @brief 自定义IO的数据源, 通过avioContext()接到AVFormatContext::pb上
+ * 读取/跳转只在demux线程中调用
+ */
+class IOSource : public ForbidCopy
+{
+public:
+    virtual ~IOSource();
+
+    virtual bool open(const QString& url) = 0;
+    virtual void close() = 0;
+    // 返回读到的字节数, 到达末尾返回AVERROR_EOF, 失败返回负的错误码
+    virtual int read(uint8_t *buf, int size) = 0;
+    // whence: SEEK_SET/SEEK_CUR/SEEK_END, 返回新的位置, 失败返回负的错误码
+    virtual int64_t seek(int64_t offset, int whence) = 0;
+    // 总长度, 未知返回负值
+    virtual int64_t size() const = 0;
+    // 打断阻塞中的read(), 可在其他线程调用, 下次open()前读取都会失败
+    virtual void interrupt() {}
+
+    // 创建AVIOContext, 由IOSource持有, 需在avformat_close_input之后才能销毁IOSource
+    AVIOContext *avioContext(int bufferSize = IO_SOURCE_BUFFER_SIZE);
+
+protected:
+    IOSource() = default;
+    void freeAVIOContext();
+
+private:
+    static int readPacket(void *opaque, uint8_t *buf, int size);
+    static int64_t seekPacket(void *opaque, int64_t offset, int whence);
+
+    AVIOContext *m_avio = nullptr;
+};
+
+#endif // IOSOURCE_H
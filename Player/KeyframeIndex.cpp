@@ -0,0 +1,164 @@
+#include "KeyframeIndex.h"
+#include "Utils.h"
+#include <QFileInfo>
+#include <QFile>
+#include <QSaveFile>
+#include <QDateTime>
+#include <QsLog.h>
+#include <algorithm>
+#include <cstring>
+
+extern "C"{
+#include <libavutil/avutil.h>
+}
+
+namespace {
+
+const char KEYFRAME_INDEX_MAGIC[4] = {'K', 'F', 'I', 'X'};
+const uint32_t KEYFRAME_INDEX_VERSION = 1; // Entry布局变化时递增
+
+// sidecar文件头, 之后紧跟count个Entry
+struct SidecarHeader{
+    char magic[4];
+    uint32_t version;
+    int64_t fileSize;
+    int64_t fileMtime; // 毫秒
+    uint64_t count;
+};
+
+bool entryLess(const KeyframeIndex::Entry& a, const KeyframeIndex::Entry& b)
+{
+    return a.pts < b.pts;
+}
+
+}
+
+KeyframeIndex::KeyframeIndex()
+    : m_fileSize(0),
+      m_fileMtime(0),
+      m_dirty(false)
+{
+}
+
+void KeyframeIndex::clear()
+{
+    m_entries.clear();
+    m_sidecarPath.clear();
+    m_fileSize = 0;
+    m_fileMtime = 0;
+    m_dirty = false;
+}
+
+bool KeyframeIndex::load(const QString &url)
+{
+    clear();
+    QFileInfo info(url);
+    if(!info.isFile()) return false;
+
+    m_fileSize = info.size();
+    m_fileMtime = info.lastModified().toMSecsSinceEpoch();
+    m_sidecarPath = Utils::cacheFilePath("keyframes", info.absoluteFilePath(), "kfi");
+    if(m_sidecarPath.isEmpty()) return false;
+
+    QFile file(m_sidecarPath);
+    if(!file.exists()) return false;
+    if(!file.open(QIODevice::ReadOnly)){
+        QLOG_ERROR() << "open keyframe index fail:" << m_sidecarPath;
+        return false;
+    }
+    qint64 size = file.size();
+    if(size < (qint64)sizeof(SidecarHeader)) return false;
+    uchar *data = file.map(0, size);
+    if(!data){
+        QLOG_ERROR() << "map keyframe index fail:" << m_sidecarPath;
+        return false;
+    }
+
+    SidecarHeader header;
+    memcpy(&header, data, sizeof(header));
+    bool valid = memcmp(header.magic, KEYFRAME_INDEX_MAGIC, sizeof(header.magic)) == 0 &&
+            header.version == KEYFRAME_INDEX_VERSION &&
+            header.fileSize == m_fileSize && header.fileMtime == m_fileMtime &&
+            (qint64)(sizeof(SidecarHeader) + header.count * sizeof(Entry)) == size;
+    if(valid){
+        m_entries.resize(header.count);
+        memcpy(m_entries.data(), data + sizeof(SidecarHeader), header.count * sizeof(Entry));
+    }
+    file.unmap(data);
+    if(!valid){
+        QLOG_INFO() << "keyframe index out of date:" << m_sidecarPath;
+        return false;
+    }
+    QLOG_INFO() << "keyframe index loaded," << m_entries.size() << "entries";
+    return true;
+}
+
+bool KeyframeIndex::save()
+{
+    if(!m_dirty || m_sidecarPath.isEmpty() || m_entries.empty()) return true;
+
+    SidecarHeader header;
+    memcpy(header.magic, KEYFRAME_INDEX_MAGIC, sizeof(header.magic));
+    header.version = KEYFRAME_INDEX_VERSION;
+    header.fileSize = m_fileSize;
+    header.fileMtime = m_fileMtime;
+    header.count = m_entries.size();
+
+    // 先写临时文件再替换, 中途退出不会留下损坏的索引
+    QSaveFile file(m_sidecarPath);
+    if(!file.open(QIODevice::WriteOnly)){
+        QLOG_ERROR() << "open keyframe index for write fail:" << m_sidecarPath;
+        return false;
+    }
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(m_entries.data()), m_entries.size() * sizeof(Entry));
+    if(!file.commit()){
+        QLOG_ERROR() << "write keyframe index fail:" << m_sidecarPath;
+        return false;
+    }
+    m_dirty = false;
+    return true;
+}
+
+void KeyframeIndex::add(int64_t pts, int64_t pos, int64_t prevPts)
+{
+    Entry entry{pts, pos, 0, 0};
+    auto it = m_entries.end();
+    // 顺序读取时直接追加
+    if(!m_entries.empty() && m_entries.back().pts >= pts){
+        it = std::lower_bound(m_entries.begin(), m_entries.end(), entry, entryLess);
+    }
+    bool contiguous = prevPts != AV_NOPTS_VALUE && it != m_entries.begin() && (it - 1)->pts == prevPts;
+    if(it != m_entries.end() && it->pts == pts){ // 已记录, 只补充连续性
+        if(contiguous && !it->contiguous){
+            it->contiguous = 1;
+            m_dirty = true;
+        }
+        return;
+    }
+    if(it != m_entries.end()){
+        it->contiguous = 0; // 中间插入了新的关键帧, 后一个条目不再与前一个紧邻
+    }
+    entry.contiguous = contiguous ? 1 : 0;
+    m_entries.insert(it, entry);
+    m_dirty = true;
+}
+
+bool KeyframeIndex::find(int64_t pts, Entry *entry, bool bracketed) const
+{
+    Entry key{pts, 0, 0, 0};
+    auto it = std::upper_bound(m_entries.begin(), m_entries.end(), key, entryLess);
+    if(it == m_entries.begin()) return false;
+    if(bracketed && (it == m_entries.end() || !it->contiguous)) return false;
+    *entry = *(it - 1);
+    return true;
+}
+
+bool KeyframeIndex::findAfter(int64_t pts, Entry *entry) const
+{
+    Entry key{pts, 0, 0, 0};
+    auto it = std::upper_bound(m_entries.begin(), m_entries.end(), key, entryLess);
+    if(it == m_entries.end()) return false;
+    *entry = *it;
+    return true;
+}
@@ -0,0 +1,55 @@
+#ifndef KEYFRAMEINDEX_H
+#define KEYFRAMEINDEX_H
+
+#include <QString>
+#include <vector>
+#include <cstdint>
+
+/**
+ * @brief 视频关键帧索引, 由demux线程在读包时记录
+ * 按pts升序保存关键帧的时间与字节位置, 跳转时二分查找目标之前最近的关键帧
+ * 本地文件的索引保存为缓存目录下的sidecar文件, 以路径/大小/修改时间区分,
+ * 文件格式为定长头+定长条目, 加载时直接映射文件
+ */
+class KeyframeIndex
+{
+public:
+    struct Entry{
+        int64_t pts; // 微秒
+        int64_t pos; // 包在文件中的字节偏移
+        int32_t contiguous; // 非0: 前一个条目就是码流中紧邻的上一个关键帧
+        int32_t reserved;
+    };
+
+    KeyframeIndex();
+
+    // 绑定本地文件并尝试加载已有的sidecar, 非本地文件返回false且不做持久化
+    bool load(const QString& url);
+    // 有新增条目时写回sidecar
+    bool save();
+    void clear();
+
+    /**
+     * @brief 记录关键帧, 仅demux线程调用
+     * @param prevPts 本次连续读取中上一个关键帧的pts, 跳转后第一个关键帧传AV_NOPTS_VALUE
+     */
+    void add(int64_t pts, int64_t pos, int64_t prevPts);
+    /**
+     * @brief 查找不晚于pts的最近关键帧
+     * @param bracketed 为true时要求找到的关键帧与下一个关键帧在码流中紧邻,
+     * 即pts一定落在两者之间, 跳转中途跳过的区间不满足该条件
+     */
+    bool find(int64_t pts, Entry *entry, bool bracketed) const;
+    // 查找晚于pts的最近关键帧, 与find()一起作为估算字节位置的锚点
+    bool findAfter(int64_t pts, Entry *entry) const;
+    inline size_t size() const {return m_entries.size();}
+
+private:
+    std::vector<Entry> m_entries;
+    QString m_sidecarPath;
+    int64_t m_fileSize;
+    int64_t m_fileMtime;
+    bool m_dirty;
+};
+
+#endif // KEYFRAMEINDEX_H
@@ -0,0 +1,108 @@
+#include "MappedFileSource.h"
+#include <QsLog.h>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+extern "C"{
+#include <libavutil/error.h>
+}
+
+MappedFileSource::MappedFileSource(int64_t windowSize)
+    : m_window(nullptr),
+      m_windowStart(0),
+      m_windowLength(0),
+      m_windowSize(std::max<int64_t>(MAPPED_IO_ALIGN, windowSize / MAPPED_IO_ALIGN * MAPPED_IO_ALIGN)),
+      m_pos(0),
+      m_size(0)
+{
+}
+
+MappedFileSource::~MappedFileSource()
+{
+    freeAVIOContext(); // 先于文件关闭, 避免libavformat继续读取
+    close();
+}
+
+bool MappedFileSource::open(const QString &url)
+{
+    close();
+    m_file.setFileName(url);
+    if(!m_file.open(QIODevice::ReadOnly)){
+        QLOG_ERROR() << "open mapped file fail:" << url;
+        return false;
+    }
+    m_size = m_file.size();
+    m_pos = 0;
+    return true;
+}
+
+void MappedFileSource::close()
+{
+    unmapWindow();
+    if(m_file.isOpen()){
+        m_file.close();
+    }
+    m_pos = 0;
+    m_size = 0;
+}
+
+int MappedFileSource::read(uint8_t *buf, int size)
+{
+    if(m_pos >= m_size) return AVERROR_EOF;
+    if(!m_window || m_pos < m_windowStart || m_pos >= m_windowStart + m_windowLength){
+        if(!mapWindow(m_pos)) return AVERROR(EIO);
+    }
+    int64_t offset = m_pos - m_windowStart;
+    int len = (int)std::min<int64_t>(size, m_windowLength - offset);
+    memcpy(buf, m_window + offset, len);
+    m_pos += len;
+    return len;
+}
+
+int64_t MappedFileSource::seek(int64_t offset, int whence)
+{
+    int64_t pos = 0;
+    switch(whence){
+    case SEEK_SET: pos = offset; break;
+    case SEEK_CUR: pos = m_pos + offset; break;
+    case SEEK_END: pos = m_size + offset; break;
+    default: return AVERROR(EINVAL);
+    }
+    if(pos < 0) return AVERROR(EINVAL);
+    m_pos = pos; // 只移动位置, 下次读取时按需映射
+    return m_pos;
+}
+
+bool MappedFileSource::mapWindow(int64_t pos)
+{
+    unmapWindow();
+    int64_t start = pos / MAPPED_IO_ALIGN * MAPPED_IO_ALIGN;
+    int64_t length = std::min(m_windowSize, m_size - start);
+    m_window = m_file.map(start, length);
+    if(!m_window){
+        QLOG_ERROR() << "map file window fail:" << m_file.errorString();
+        return false;
+    }
+    m_windowStart = start;
+    m_windowLength = length;
+#ifndef _WIN32
+    // 起点按页对齐时映射地址也是页对齐的
+    madvise(m_window, length, MADV_SEQUENTIAL);
+    madvise(m_window, length, MADV_WILLNEED);
+#endif
+    return true;
+}
+
+void MappedFileSource::unmapWindow()
+{
+    if(!m_window) return;
+    m_file.unmap(m_window);
+    m_window = nullptr;
+    m_windowStart = 0;
+    m_windowLength = 0;
+}
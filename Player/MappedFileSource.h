@@ -0,0 +1,43 @@
+#ifndef MAPPEDFILESOURCE_H
+#define MAPPEDFILESOURCE_H
+
+#include <QFile>
+#include "IOSource.h"
+
+// 默认映射窗口大小
+#define MAPPED_IO_WINDOW (64LL * 1024 * 1024)
+// 窗口起点对齐, 取Windows的分配粒度, 同时是各平台页大小的整数倍
+#define MAPPED_IO_ALIGN (64 * 1024)
+
+/**
+ * @brief 本地文件的内存映射数据源
+ * 每次只映射一个窗口, 读取越出窗口时重新映射, 窗口内的跳转只是移动位置
+ * POSIX平台上通过madvise提示内核顺序读取并预读
+ */
+class MappedFileSource : public IOSource
+{
+public:
+    explicit MappedFileSource(int64_t windowSize = MAPPED_IO_WINDOW);
+    ~MappedFileSource();
+
+    bool open(const QString& url) override;
+    void close() override;
+    int read(uint8_t *buf, int size) override;
+    int64_t seek(int64_t offset, int whence) override;
+    inline int64_t size() const override {return m_size;}
+
+private:
+    // 映射包含pos的窗口
+    bool mapWindow(int64_t pos);
+    void unmapWindow();
+
+    QFile m_file;
+    uchar *m_window;
+    int64_t m_windowStart;
+    int64_t m_windowLength;
+    const int64_t m_windowSize;
+    int64_t m_pos;
+    int64_t m_size;
+};
+
+#endif // MAPPEDFILESOURCE_H
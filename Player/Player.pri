@@ -1,10 +1,33 @@
 SOURCES += \
     $$PWD/AVPlayer.cpp \
-    $$PWD/Decoder.cpp
+    $$PWD/Decoder.cpp \
+    $$PWD/KeyframeIndex.cpp \
+    $$PWD/IOSource.cpp \
+    $$PWD/MappedFileSource.cpp \
+    $$PWD/ReadAheadSource.cpp \
+    $$PWD/HttpRangeCache.cpp \
+    $$PWD/HttpSource.cpp \
+    $$PWD/TimeshiftRecorder.cpp \
+    $$PWD/TimeshiftSource.cpp \
+    $$PWD/StreamInfoCache.cpp \
+    $$PWD/CodecContextPool.cpp \
+    $$PWD/FrameBufferPool.cpp
 
 HEADERS += \
     $$PWD/AVPlayer.h \
     $$PWD/Decoder.h \
-    $$PWD/YUV422Frame.h
+    $$PWD/KeyframeIndex.h \
+    $$PWD/IOSource.h \
+    $$PWD/MappedFileSource.h \
+    $$PWD/ReadAheadSource.h \
+    $$PWD/HttpRangeCache.h \
+    $$PWD/HttpSource.h \
+    $$PWD/TimeshiftRecorder.h \
+    $$PWD/TimeshiftSource.h \
+    $$PWD/StreamInfoCache.h \
+    $$PWD/CodecContextPool.h \
+    $$PWD/FrameBufferPool.h \
+    $$PWD/VideoFrame.h \
+    $$PWD/VideoPresenter.h
 
 INCLUDEPATH += Player
@@ -0,0 +1,197 @@
+#include "ReadAheadSource.h"
+#include <QsLog.h>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <chrono>
+#include <new>
+
+extern "C"{
+#include <libavutil/error.h>
+#include <libavutil/time.h>
+}
+
+ReadAheadSource::ReadAheadSource(std::unique_ptr<IOSource> source, int64_t depth, int chunkSize)
+    : m_source(std::move(source)),
+      m_capacity(std::max<int64_t>(std::max(4096, chunkSize) * 2LL, depth)),
+      m_chunkSize(std::max(4096, chunkSize)),
+      m_size(-1),
+      m_interrupt(nullptr),
+      m_interruptOpaque(nullptr),
+      m_readPos(0),
+      m_bufStart(0),
+      m_bufEnd(0),
+      m_seekRequest(-1),
+      m_generation(0),
+      m_error(0),
+      m_exit(false)
+{
+}
+
+ReadAheadSource::~ReadAheadSource()
+{
+    freeAVIOContext(); // 先于预读线程退出, 避免libavformat继续读取
+    close();
+}
+
+bool ReadAheadSource::open(const QString &url)
+{
+    close();
+    if(!m_source->open(url)) return false;
+    if(!m_ring){
+        m_ring.reset(new (std::nothrow) uint8_t[(size_t)m_capacity]);
+        if(!m_ring){
+            QLOG_ERROR() << "read ahead buffer alloc fail" << m_capacity;
+            m_source->close();
+            return false;
+        }
+    }
+    m_size = m_source->size();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_readPos = m_bufStart = m_bufEnd = 0;
+        m_seekRequest = -1;
+        m_error = 0;
+        m_exit = false;
+        m_stats = Stats();
+    }
+    m_thread.start("readAhead", [this](){
+        this->readLoop();
+    });
+    return true;
+}
+
+void ReadAheadSource::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_exit = true;
+    }
+    m_source->interrupt(); // 预读线程可能阻塞在网络读取上
+    m_spaceCond.notify_all();
+    m_dataCond.notify_all();
+    m_thread.joinAll();
+    m_source->close();
+    m_size = -1;
+}
+
+void ReadAheadSource::setInterruptCallback(int (*callback)(void *), void *opaque)
+{
+    m_interrupt = callback;
+    m_interruptOpaque = opaque;
+}
+
+ReadAheadSource::Stats ReadAheadSource::stats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Stats stats = m_stats;
+    stats.buffered = m_seekRequest < 0 ? m_bufEnd - m_readPos : 0;
+    stats.capacity = m_capacity;
+    return stats;
+}
+
+int ReadAheadSource::read(uint8_t *buf, int size)
+{
+    const int64_t capacity = m_capacity;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if(m_readPos >= m_bufEnd && !m_error){
+        // 缓冲区已空, 等待预读线程
+        int64_t start = av_gettime_relative();
+        while(m_readPos >= m_bufEnd && !m_error && !m_exit){
+            if(m_interrupt && m_interrupt(m_interruptOpaque)) return AVERROR_EXIT;
+            m_dataCond.wait_for(lock, std::chrono::milliseconds(READ_AHEAD_POLL_MS));
+        }
+        m_stats.stalls++;
+        m_stats.maxStallMs = std::max(m_stats.maxStallMs, (av_gettime_relative() - start) / 1000.0);
+    }
+    if(m_exit) return AVERROR_EXIT;
+    if(m_readPos >= m_bufEnd) return m_error;
+
+    // [m_readPos, m_bufEnd)不会被预读线程改写, 拷贝时不需要持锁
+    int64_t offset = m_readPos % capacity;
+    int len = (int)std::min<int64_t>(size, std::min(m_bufEnd - m_readPos, capacity - offset));
+    lock.unlock();
+    memcpy(buf, m_ring.get() + offset, len);
+    lock.lock();
+    m_readPos += len;
+    lock.unlock();
+    m_spaceCond.notify_one();
+    return len;
+}
+
+int64_t ReadAheadSource::seek(int64_t offset, int whence)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    int64_t pos = 0;
+    switch(whence){
+    case SEEK_SET: pos = offset; break;
+    case SEEK_CUR: pos = m_readPos + offset; break;
+    case SEEK_END:
+        if(m_size < 0) return AVERROR(ENOSYS);
+        pos = m_size + offset;
+        break;
+    default: return AVERROR(EINVAL);
+    }
+    if(pos < 0) return AVERROR(EINVAL);
+    if(pos >= m_bufStart && pos <= m_bufEnd){
+        m_readPos = pos; // 落在缓冲区内, 只移动位置
+    }
+    else{
+        // 丢弃缓冲区, 由预读线程跳转到新位置重新读取
+        m_readPos = m_bufStart = m_bufEnd = pos;
+        m_seekRequest = pos;
+        m_generation++;
+        m_error = 0;
+    }
+    lock.unlock();
+    m_spaceCond.notify_one();
+    return pos;
+}
+
+void ReadAheadSource::readLoop()
+{
+    const int64_t capacity = m_capacity;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while(!m_exit){
+        if(m_seekRequest >= 0){
+            int64_t pos = m_seekRequest;
+            int generation = m_generation;
+            m_seekRequest = -1;
+            lock.unlock();
+            int64_t ret = m_source->seek(pos, SEEK_SET);
+            lock.lock();
+            if(ret < 0 && generation == m_generation){
+                m_error = (int)ret;
+                m_dataCond.notify_all();
+            }
+            continue;
+        }
+        if(m_error || m_bufEnd - m_readPos >= capacity){
+            m_spaceCond.wait(lock); // 已读到末尾或缓冲区已满
+            continue;
+        }
+
+        int64_t pos = m_bufEnd;
+        int generation = m_generation;
+        int64_t offset = pos % capacity;
+        int len = (int)std::min<int64_t>(m_chunkSize, std::min(capacity - offset, capacity - (pos - m_readPos)));
+        // 即将被覆盖的旧数据移出缓冲区, 之后的跳转不会再落到这里
+        m_bufStart = std::max(m_bufStart, pos + len - capacity);
+        lock.unlock();
+        int ret = m_source->read(m_ring.get() + offset, len);
+        lock.lock();
+        if(generation != m_generation) continue; // 读取期间发生了跳转
+        if(ret < 0){
+            m_error = ret;
+            if(ret != AVERROR_EOF){
+                char errBuf[AV_ERROR_MAX_STRING_SIZE] = {0};
+                av_strerror(ret, errBuf, sizeof(errBuf));
+                QLOG_ERROR() << "read ahead fail" << errBuf;
+            }
+        }
+        else{
+            m_bufEnd += ret;
+        }
+        m_dataCond.notify_all();
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef READAHEADSOURCE_H
+#define READAHEADSOURCE_H
+
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include "IOSource.h"
+#include "PipelineThreads.h"
+
+// 预读缓冲区大小
+#define READ_AHEAD_DEPTH (32LL * 1024 * 1024)
+// 预读线程单次读取的大小
+#define READ_AHEAD_CHUNK (256 * 1024)
+// demux线程等待数据时检查中断回调的间隔(毫秒)
+#define READ_AHEAD_POLL_MS 10
+
+/**
+ * @brief 预读数据源, 包装另一个IOSource
+ * 独立的预读线程按块从内层数据源读入环形缓冲区, demux线程只从内存中解析,
+ * 磁盘或网络的短暂卡顿由缓冲区吸收
+ * 环中保留已读过的数据直到被覆盖, 跳转落在缓冲区内时不需要重新读取
+ */
+class ReadAheadSource : public IOSource
+{
+public:
+    struct Stats{
+        int64_t buffered = 0; // 读位置之后已缓冲的字节数
+        int64_t capacity = 0;
+        int stalls = 0; // demux线程等待数据的次数
+        double maxStallMs = 0.0; // 单次等待最长耗时
+    };
+
+    ReadAheadSource(std::unique_ptr<IOSource> source, int64_t depth = READ_AHEAD_DEPTH, int chunkSize = READ_AHEAD_CHUNK);
+    ~ReadAheadSource();
+
+    // 打开内层数据源并启动预读线程
+    bool open(const QString& url) override;
+    void close() override;
+    int read(uint8_t *buf, int size) override;
+    int64_t seek(int64_t offset, int whence) override;
+    inline int64_t size() const override {return m_size;}
+
+    // read()等待数据时周期性调用, 返回非0时放弃等待并返回AVERROR_EXIT
+    void setInterruptCallback(int (*callback)(void*), void *opaque);
+    Stats stats() const;
+
+private:
+    void readLoop();
+
+    std::unique_ptr<IOSource> m_source;
+    std::unique_ptr<uint8_t[]> m_ring; // 首次open()时分配, 不做清零
+    const int64_t m_capacity;
+    const int m_chunkSize;
+    int64_t m_size;
+    int (*m_interrupt)(void*);
+    void *m_interruptOpaque;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_dataCond; // demux线程等待数据
+    std::condition_variable m_spaceCond; // 预读线程等待空位或跳转
+    // 以下均为文件偏移, 环中[m_bufStart, m_bufEnd)有效, 偏移o位于m_ring[o % 容量]
+    int64_t m_readPos;
+    int64_t m_bufStart;
+    int64_t m_bufEnd;
+    int64_t m_seekRequest; // 预读线程待执行的跳转, <0表示没有
+    int m_generation; // 每次缓冲区外的跳转加一, 预读线程据此丢弃过期的数据
+    int m_error; // 预读线程遇到的末尾或错误, 读完缓冲区后返回
+    bool m_exit;
+    Stats m_stats;
+
+    PipelineThreads m_thread;
+};
+
+#endif // READAHEADSOURCE_H
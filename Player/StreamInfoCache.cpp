@@ -0,0 +1,296 @@
+#include "StreamInfoCache.h"
+#include "Utils.h"
+#include <QFileInfo>
+#include <QFile>
+#include <QSaveFile>
+#include <QDateTime>
+#include <QByteArray>
+#include <QsLog.h>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+const char STREAM_INFO_MAGIC[4] = {'S', 'I', 'N', 'F'};
+const uint32_t STREAM_INFO_VERSION = 1; // 记录布局变化时递增
+
+struct CacheHeader{
+    char magic[4];
+    uint32_t version;
+    int64_t fileSize;
+    int64_t fileMtime; // 毫秒
+    char formatName[32];
+    int64_t duration;
+    int64_t startTime;
+    int64_t bitRate;
+    int32_t streamCount;
+    int32_t reserved;
+};
+
+// 每路流一条, 之后紧跟extradataSize字节的extradata
+struct StreamRecord{
+    int32_t codecType;
+    int32_t codecId;
+    uint32_t codecTag;
+    int32_t format;
+    int64_t bitRate;
+    int32_t bitsPerCodedSample;
+    int32_t bitsPerRawSample;
+    int32_t profile;
+    int32_t level;
+    int32_t width;
+    int32_t height;
+    AVRational sampleAspectRatio;
+    int32_t fieldOrder;
+    int32_t colorRange;
+    int32_t colorPrimaries;
+    int32_t colorTrc;
+    int32_t colorSpace;
+    int32_t chromaLocation;
+    int32_t videoDelay;
+    int32_t channelOrder;
+    int32_t channels;
+    uint64_t channelMask;
+    int32_t sampleRate;
+    int32_t blockAlign;
+    int32_t frameSize;
+    int32_t initialPadding;
+    AVRational timeBase;
+    AVRational avgFrameRate;
+    AVRational rFrameRate;
+    int64_t streamStartTime;
+    int64_t streamDuration;
+    int32_t extradataSize;
+    int32_t reserved;
+};
+
+bool sameRational(AVRational a, AVRational b)
+{
+    return a.num == b.num && a.den == b.den;
+}
+
+}
+
+QString StreamInfoCache::cachePath(const QString &url, int64_t *fileSize, int64_t *fileMtime)
+{
+    QFileInfo info(url);
+    if(!info.isFile()) return QString();
+    *fileSize = info.size();
+    *fileMtime = info.lastModified().toMSecsSinceEpoch();
+    return Utils::cacheFilePath("streaminfo", info.absoluteFilePath(), "sinf");
+}
+
+bool StreamInfoCache::isComplete(const AVFormatContext *ctx)
+{
+    for(unsigned int i = 0; i < ctx->nb_streams; i++){
+        const AVCodecParameters *par = ctx->streams[i]->codecpar;
+        if(par->codec_id == AV_CODEC_ID_NONE) return false;
+        if(par->codec_type == AVMEDIA_TYPE_VIDEO &&
+                (par->width <= 0 || par->height <= 0 || par->format < 0)){
+            return false;
+        }
+        if(par->codec_type == AVMEDIA_TYPE_AUDIO &&
+                (par->sample_rate <= 0 || par->ch_layout.nb_channels <= 0 || par->format < 0 || par->frame_size <= 0)){
+            return false;
+        }
+    }
+    return ctx->nb_streams > 0 && ctx->duration != AV_NOPTS_VALUE;
+}
+
+bool StreamInfoCache::restore(const QString &url, AVFormatContext *ctx)
+{
+    int64_t fileSize = 0;
+    int64_t fileMtime = 0;
+    QString path = cachePath(url, &fileSize, &fileMtime);
+    if(path.isEmpty()) return false;
+    QFile file(path);
+    if(!file.exists() || !file.open(QIODevice::ReadOnly)) return false;
+    QByteArray data = file.readAll();
+    file.close();
+
+    // 先完整校验, 全部一致后才修改ctx
+    if(data.size() < (int)sizeof(CacheHeader)) return false;
+    CacheHeader header;
+    memcpy(&header, data.constData(), sizeof(header));
+    if(memcmp(header.magic, STREAM_INFO_MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != STREAM_INFO_VERSION ||
+            header.fileSize != fileSize || header.fileMtime != fileMtime ||
+            strncmp(header.formatName, ctx->iformat->name, sizeof(header.formatName) - 1) != 0 ||
+            header.streamCount != (int32_t)ctx->nb_streams){
+        return false;
+    }
+
+    std::vector<StreamRecord> records(header.streamCount);
+    std::vector<int> extradataOffsets(header.streamCount);
+    int offset = sizeof(CacheHeader);
+    for(int i = 0; i < header.streamCount; i++){
+        if(data.size() < offset + (int)sizeof(StreamRecord)) return false;
+        memcpy(&records[i], data.constData() + offset, sizeof(StreamRecord));
+        offset += sizeof(StreamRecord);
+        extradataOffsets[i] = offset;
+        if(records[i].extradataSize < 0 || data.size() < offset + records[i].extradataSize) return false;
+        offset += records[i].extradataSize;
+
+        const AVStream *st = ctx->streams[i];
+        const AVCodecParameters *par = st->codecpar;
+        if(par->codec_type != records[i].codecType ||
+                (par->codec_id != AV_CODEC_ID_NONE && par->codec_id != records[i].codecId) ||
+                !sameRational(st->time_base, records[i].timeBase)){
+            return false;
+        }
+    }
+
+    // 按"demuxer值优先, 缺失时取缓存值"预先判断补全后是否完整, 不完整则不动ctx
+    for(int i = 0; i < header.streamCount; i++){
+        const StreamRecord& rec = records[i];
+        const AVCodecParameters *par = ctx->streams[i]->codecpar;
+        int codecId = par->codec_id != AV_CODEC_ID_NONE ? par->codec_id : rec.codecId;
+        int format = par->format >= 0 ? par->format : rec.format;
+        if(codecId == AV_CODEC_ID_NONE) return false;
+        if(par->codec_type == AVMEDIA_TYPE_VIDEO){
+            int width = par->width > 0 ? par->width : rec.width;
+            int height = par->height > 0 ? par->height : rec.height;
+            if(width <= 0 || height <= 0 || format < 0) return false;
+        }
+        else if(par->codec_type == AVMEDIA_TYPE_AUDIO){
+            int sampleRate = par->sample_rate > 0 ? par->sample_rate : rec.sampleRate;
+            int channels = par->ch_layout.nb_channels > 0 ? par->ch_layout.nb_channels : rec.channels;
+            int frameSize = par->frame_size ? par->frame_size : rec.frameSize;
+            if(sampleRate <= 0 || channels <= 0 || format < 0 || frameSize <= 0) return false;
+        }
+    }
+    if(ctx->nb_streams == 0 || (ctx->duration == AV_NOPTS_VALUE && header.duration == AV_NOPTS_VALUE)) return false;
+
+    // 只补全demuxer没有给出的字段
+    for(int i = 0; i < header.streamCount; i++){
+        const StreamRecord& rec = records[i];
+        AVStream *st = ctx->streams[i];
+        AVCodecParameters *par = st->codecpar;
+        if(par->codec_id == AV_CODEC_ID_NONE) par->codec_id = (AVCodecID)rec.codecId;
+        if(!par->codec_tag) par->codec_tag = rec.codecTag;
+        if(par->format < 0) par->format = rec.format;
+        if(!par->bit_rate) par->bit_rate = rec.bitRate;
+        if(!par->bits_per_coded_sample) par->bits_per_coded_sample = rec.bitsPerCodedSample;
+        if(!par->bits_per_raw_sample) par->bits_per_raw_sample = rec.bitsPerRawSample;
+        if(par->profile == AV_PROFILE_UNKNOWN) par->profile = rec.profile;
+        if(par->level == AV_LEVEL_UNKNOWN) par->level = rec.level;
+        if(par->codec_type == AVMEDIA_TYPE_VIDEO){
+            if(par->width <= 0) par->width = rec.width;
+            if(par->height <= 0) par->height = rec.height;
+            if(!par->sample_aspect_ratio.num) par->sample_aspect_ratio = rec.sampleAspectRatio;
+            if(par->field_order == AV_FIELD_UNKNOWN) par->field_order = (AVFieldOrder)rec.fieldOrder;
+            if(par->color_range == AVCOL_RANGE_UNSPECIFIED) par->color_range = (AVColorRange)rec.colorRange;
+            if(par->color_primaries == AVCOL_PRI_UNSPECIFIED) par->color_primaries = (AVColorPrimaries)rec.colorPrimaries;
+            if(par->color_trc == AVCOL_TRC_UNSPECIFIED) par->color_trc = (AVColorTransferCharacteristic)rec.colorTrc;
+            if(par->color_space == AVCOL_SPC_UNSPECIFIED) par->color_space = (AVColorSpace)rec.colorSpace;
+            if(par->chroma_location == AVCHROMA_LOC_UNSPECIFIED) par->chroma_location = (AVChromaLocation)rec.chromaLocation;
+            if(!par->video_delay) par->video_delay = rec.videoDelay;
+            if(!st->avg_frame_rate.num) st->avg_frame_rate = rec.avgFrameRate;
+            if(!st->r_frame_rate.num) st->r_frame_rate = rec.rFrameRate;
+        }
+        else if(par->codec_type == AVMEDIA_TYPE_AUDIO){
+            if(par->ch_layout.nb_channels <= 0){
+                av_channel_layout_uninit(&par->ch_layout);
+                if(rec.channelOrder == AV_CHANNEL_ORDER_NATIVE){
+                    av_channel_layout_from_mask(&par->ch_layout, rec.channelMask);
+                }
+                else{
+                    av_channel_layout_default(&par->ch_layout, rec.channels);
+                }
+            }
+            if(par->sample_rate <= 0) par->sample_rate = rec.sampleRate;
+            if(!par->block_align) par->block_align = rec.blockAlign;
+            if(!par->frame_size) par->frame_size = rec.frameSize;
+            if(!par->initial_padding) par->initial_padding = rec.initialPadding;
+        }
+        if(!par->extradata && rec.extradataSize > 0){
+            par->extradata = (uint8_t*)av_mallocz(rec.extradataSize + AV_INPUT_BUFFER_PADDING_SIZE);
+            if(par->extradata){
+                memcpy(par->extradata, data.constData() + extradataOffsets[i], rec.extradataSize);
+                par->extradata_size = rec.extradataSize;
+            }
+        }
+        if(st->start_time == AV_NOPTS_VALUE) st->start_time = rec.streamStartTime;
+        if(st->duration == AV_NOPTS_VALUE) st->duration = rec.streamDuration;
+    }
+    if(ctx->duration == AV_NOPTS_VALUE) ctx->duration = header.duration;
+    if(ctx->start_time == AV_NOPTS_VALUE) ctx->start_time = header.startTime;
+    if(!ctx->bit_rate) ctx->bit_rate = header.bitRate;
+    return isComplete(ctx);
+}
+
+bool StreamInfoCache::store(const QString &url, const AVFormatContext *ctx)
+{
+    int64_t fileSize = 0;
+    int64_t fileMtime = 0;
+    QString path = cachePath(url, &fileSize, &fileMtime);
+    if(path.isEmpty() || !isComplete(ctx)) return false;
+
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, STREAM_INFO_MAGIC, sizeof(header.magic));
+    header.version = STREAM_INFO_VERSION;
+    header.fileSize = fileSize;
+    header.fileMtime = fileMtime;
+    strncpy(header.formatName, ctx->iformat->name, sizeof(header.formatName) - 1);
+    header.duration = ctx->duration;
+    header.startTime = ctx->start_time;
+    header.bitRate = ctx->bit_rate;
+    header.streamCount = ctx->nb_streams;
+
+    QByteArray data(reinterpret_cast<const char*>(&header), sizeof(header));
+    for(unsigned int i = 0; i < ctx->nb_streams; i++){
+        const AVStream *st = ctx->streams[i];
+        const AVCodecParameters *par = st->codecpar;
+        StreamRecord rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.codecType = par->codec_type;
+        rec.codecId = par->codec_id;
+        rec.codecTag = par->codec_tag;
+        rec.format = par->format;
+        rec.bitRate = par->bit_rate;
+        rec.bitsPerCodedSample = par->bits_per_coded_sample;
+        rec.bitsPerRawSample = par->bits_per_raw_sample;
+        rec.profile = par->profile;
+        rec.level = par->level;
+        rec.width = par->width;
+        rec.height = par->height;
+        rec.sampleAspectRatio = par->sample_aspect_ratio;
+        rec.fieldOrder = par->field_order;
+        rec.colorRange = par->color_range;
+        rec.colorPrimaries = par->color_primaries;
+        rec.colorTrc = par->color_trc;
+        rec.colorSpace = par->color_space;
+        rec.chromaLocation = par->chroma_location;
+        rec.videoDelay = par->video_delay;
+        rec.channelOrder = par->ch_layout.order;
+        rec.channels = par->ch_layout.nb_channels;
+        rec.channelMask = par->ch_layout.order == AV_CHANNEL_ORDER_NATIVE ? par->ch_layout.u.mask : 0;
+        rec.sampleRate = par->sample_rate;
+        rec.blockAlign = par->block_align;
+        rec.frameSize = par->frame_size;
+        rec.initialPadding = par->initial_padding;
+        rec.timeBase = st->time_base;
+        rec.avgFrameRate = st->avg_frame_rate;
+        rec.rFrameRate = st->r_frame_rate;
+        rec.streamStartTime = st->start_time;
+        rec.streamDuration = st->duration;
+        rec.extradataSize = par->extradata ? par->extradata_size : 0;
+        data.append(reinterpret_cast<const char*>(&rec), sizeof(rec));
+        if(rec.extradataSize > 0){
+            data.append(reinterpret_cast<const char*>(par->extradata), rec.extradataSize);
+        }
+    }
+
+    QSaveFile file(path);
+    if(!file.open(QIODevice::WriteOnly)){
+        QLOG_ERROR() << "open stream info cache for write fail:" << path;
+        return false;
+    }
+    file.write(data);
+    if(!file.commit()){
+        QLOG_ERROR() << "write stream info cache fail:" << path;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,33 @@
+#ifndef STREAMINFOCACHE_H
+#define STREAMINFOCACHE_H
+
+#include <QString>
+
+extern "C"{
+#include <libavformat/avformat.h>
+}
+
+/**
+ * @brief 本地文件探测结果的磁盘缓存
+ * avformat_find_stream_info 成功后保存各流的编码参数/时间基/帧率/时长,
+ * 再次打开同一文件(路径/大小/修改时间均一致)时直接补全, 跳过探测
+ */
+class StreamInfoCache
+{
+public:
+    /**
+     * @brief 用缓存补全avformat_open_input之后的ctx
+     * 缓存与demuxer给出的流不一致(数量/类型/编码/时间基)时不做修改
+     * @return 补全后播放所需参数齐全, 可以跳过avformat_find_stream_info
+     */
+    static bool restore(const QString& url, AVFormatContext *ctx);
+    // 保存探测结果, 非本地文件忽略
+    static bool store(const QString& url, const AVFormatContext *ctx);
+
+private:
+    static QString cachePath(const QString& url, int64_t *fileSize, int64_t *fileMtime);
+    // 播放需要的参数是否齐全
+    static bool isComplete(const AVFormatContext *ctx);
+};
+
+#endif // STREAMINFOCACHE_H
@@ -0,0 +1,345 @@
+#include "TimeshiftRecorder.h"
+#include "Utils.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QsLog.h>
+#include <algorithm>
+#include <chrono>
+
+extern "C"{
+#include <libavutil/error.h>
+#include <libavutil/opt.h>
+#include <libavutil/time.h>
+}
+
+// 其他录制目录超过该时间(秒)没有写入, 视为上次异常退出遗留, 启动时删除
+#define TIMESHIFT_STALE_SECONDS 60
+
+TimeshiftRecorder::TimeshiftRecorder()
+    : m_outCtx(nullptr),
+      m_videoOutIndex(-1),
+      m_segmentCount(0),
+      m_window(0),
+      m_maxBytes(0),
+      m_dropped(0),
+      m_lastFlushTime(0),
+      m_waitingReaders(0),
+      m_queue(TIMESHIFT_QUEUE_SIZE),
+      m_exit(false)
+{
+}
+
+TimeshiftRecorder::~TimeshiftRecorder()
+{
+    stop();
+}
+
+bool TimeshiftRecorder::start(const AVFormatContext *input, int audioIndex, int videoIndex, double window, int64_t maxBytes)
+{
+    stop();
+    if(audioIndex < 0 && videoIndex < 0) return false;
+
+    QString dirPath = Utils::cacheFilePath("timeshift", QString::number(av_gettime()) + QString::number((quintptr)this), "d");
+    if(dirPath.isEmpty() || !Utils::mkDirs(dirPath)){
+        QLOG_ERROR() << "create timeshift dir fail";
+        return false;
+    }
+    QDir root(QFileInfo(dirPath).absolutePath());
+    QDateTime now = QDateTime::currentDateTime();
+    for(const QFileInfo& entry : root.entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot)){
+        if(entry.absoluteFilePath() != QFileInfo(dirPath).absoluteFilePath()
+                && entry.lastModified().secsTo(now) > TIMESHIFT_STALE_SECONDS){
+            QDir(entry.absoluteFilePath()).removeRecursively();
+        }
+    }
+
+    int ret = avformat_alloc_output_context2(&m_outCtx, nullptr, "mpegts", nullptr);
+    if(ret < 0 || !m_outCtx){
+        QLOG_ERROR() << "alloc timeshift muxer fail";
+        m_outCtx = nullptr;
+        QDir(dirPath).removeRecursively();
+        return false;
+    }
+    m_dir = dirPath;
+    m_streamMap.assign(input->nb_streams, -1);
+    m_inputTimeBase.assign(input->nb_streams, AVRational{1, AV_TIME_BASE});
+    m_videoOutIndex = -1;
+    for(int index : {videoIndex, audioIndex}){
+        if(index < 0) continue;
+        AVStream *in = input->streams[index];
+        AVStream *out = avformat_new_stream(m_outCtx, nullptr);
+        if(!out || avcodec_parameters_copy(out->codecpar, in->codecpar) < 0){
+            QLOG_ERROR() << "create timeshift stream fail";
+            stop();
+            return false;
+        }
+        out->codecpar->codec_tag = 0;
+        out->time_base = in->time_base;
+        m_streamMap[index] = out->index;
+        m_inputTimeBase[index] = in->time_base;
+        if(index == videoIndex) m_videoOutIndex = out->index;
+    }
+
+    m_segmentCount = 0;
+    m_window = (int64_t)(window * AV_TIME_BASE);
+    m_maxBytes = maxBytes;
+    m_dropped.store(0);
+    m_exit = false;
+    if(!openSegment()){
+        stop();
+        return false;
+    }
+    ret = avformat_write_header(m_outCtx, nullptr);
+    if(ret < 0){
+        char errBuf[AV_ERROR_MAX_STRING_SIZE] = {0};
+        av_strerror(ret, errBuf, sizeof(errBuf));
+        QLOG_ERROR() << "write timeshift header fail" << errBuf;
+        stop();
+        return false;
+    }
+    m_thread.start("timeshift", [this](){
+        this->writeLoop();
+    });
+    QLOG_INFO() << "timeshift recording to" << m_dir;
+    return true;
+}
+
+void TimeshiftRecorder::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_exit = true;
+    }
+    m_queue.wakeAll();
+    m_dataCond.notify_all();
+    m_thread.joinAll();
+
+    // 写线程已退出, 由当前线程取出剩余的包
+    while(AVPacket **slot = m_queue.peek()){
+        av_packet_free(slot);
+        m_queue.pop();
+    }
+    if(m_outCtx){
+        if(m_outCtx->pb){
+            avio_closep(&m_outCtx->pb);
+        }
+        avformat_free_context(m_outCtx);
+        m_outCtx = nullptr;
+        if(m_dropped.load() > 0){
+            QLOG_INFO() << "timeshift dropped" << m_dropped.load() << "packets";
+        }
+    }
+    removeFiles();
+}
+
+void TimeshiftRecorder::push(const AVPacket *pkt)
+{
+    if(!m_outCtx || pkt->stream_index < 0 || pkt->stream_index >= (int)m_streamMap.size()
+            || m_streamMap[pkt->stream_index] < 0){
+        return;
+    }
+    AVPacket **slot = m_queue.pushSlot();
+    if(!slot){
+        m_dropped.fetch_add(1); // 磁盘跟不上时丢包, 不拖慢直播读取
+        return;
+    }
+    *slot = av_packet_clone(pkt);
+    if(!*slot) return;
+    m_queue.commitPush();
+}
+
+bool TimeshiftRecorder::range(int64_t *start, int64_t *end) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(m_segments.empty() || m_segments.front().startPts == AV_NOPTS_VALUE) return false;
+    *start = m_segments.front().startPts;
+    *end = m_segments.back().endPts;
+    return true;
+}
+
+int64_t TimeshiftRecorder::offsetFor(int64_t target) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for(auto it = m_segments.rbegin(); it != m_segments.rend(); ++it){
+        if(it->startPts != AV_NOPTS_VALUE && it->startPts <= target) return it->offset;
+    }
+    return m_segments.empty() ? 0 : m_segments.front().offset;
+}
+
+int TimeshiftRecorder::read(int64_t *pos, uint8_t *buf, int size)
+{
+    QString path;
+    int64_t local = 0;
+    int64_t available = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(m_segments.empty()) return m_exit ? AVERROR_EOF : 0;
+        if(*pos < m_segments.front().offset){
+            *pos = m_segments.front().offset; // 已被删除, 从最早保留的分段继续
+        }
+        for(const Segment& segment : m_segments){
+            if(*pos < segment.offset + segment.size){
+                path = segment.path;
+                local = *pos - segment.offset;
+                available = segment.size - local;
+                break;
+            }
+        }
+        if(path.isEmpty()) return m_exit ? AVERROR_EOF : 0;
+    }
+    // 每次读取都重新打开, 不长期占用文件, 分段可以随时删除
+    QFile file(path);
+    if(!file.open(QIODevice::ReadOnly) || !file.seek(local)) return 0; // 刚被删除, 下次读取时后移
+    qint64 len = file.read((char*)buf, std::min<int64_t>(size, available));
+    if(len < 0) return AVERROR(EIO);
+    *pos += len;
+    return (int)len;
+}
+
+bool TimeshiftRecorder::waitData(int64_t pos, int timeoutMs)
+{
+    m_waitingReaders++; // 写线程收到下一个包时立即写入文件
+    std::unique_lock<std::mutex> lock(m_mutex);
+    bool ready = m_dataCond.wait_for(lock, std::chrono::milliseconds(timeoutMs), [&](){
+        return m_exit || (!m_segments.empty() && m_segments.back().offset + m_segments.back().size > pos);
+    }) && !m_exit;
+    m_waitingReaders--;
+    return ready;
+}
+
+void TimeshiftRecorder::writeLoop()
+{
+    while(m_queue.waitReadable(1, [this](){return m_exit.load();})){
+        AVPacket *pkt = *m_queue.peek();
+        m_queue.pop();
+        writePacket(pkt);
+        av_packet_free(&pkt);
+    }
+}
+
+void TimeshiftRecorder::writePacket(AVPacket *pkt)
+{
+    if(!m_outCtx->pb) return; // 打开分段失败, 停止录制
+    int inIndex = pkt->stream_index;
+    int outIndex = m_streamMap[inIndex];
+    if(pkt->dts == AV_NOPTS_VALUE) pkt->dts = pkt->pts;
+    if(pkt->pts == AV_NOPTS_VALUE) pkt->pts = pkt->dts;
+    if(pkt->pts == AV_NOPTS_VALUE) return;
+
+    int64_t pts = av_rescale_q(pkt->pts, m_inputTimeBase[inIndex], AV_TIME_BASE_Q);
+    bool boundary = m_videoOutIndex < 0 || (outIndex == m_videoOutIndex && (pkt->flags & AV_PKT_FLAG_KEY));
+    int64_t segmentStart = AV_NOPTS_VALUE;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        segmentStart = m_segments.back().startPts;
+    }
+    if(segmentStart == AV_NOPTS_VALUE){
+        if(!boundary) return; // 每个分段从关键帧开始, 跳转后可以直接解码
+    }
+    else if(boundary && pts - segmentStart >= (int64_t)(TIMESHIFT_SEGMENT_DURATION * AV_TIME_BASE)){
+        // 输出复用器内部缓存的数据, 之后切到新的分段, 并在开头重新写PAT/PMT
+        av_write_frame(m_outCtx, nullptr);
+        avio_flush(m_outCtx->pb);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_segments.back().size = avio_tell(m_outCtx->pb);
+        }
+        avio_closep(&m_outCtx->pb);
+        av_opt_set(m_outCtx->priv_data, "mpegts_flags", "resend_headers", 0);
+        if(!openSegment()) return;
+        trimSegments();
+    }
+
+    pkt->stream_index = outIndex;
+    av_packet_rescale_ts(pkt, m_inputTimeBase[inIndex], m_outCtx->streams[outIndex]->time_base);
+    int ret = av_write_frame(m_outCtx, pkt);
+    if(ret < 0){
+        if(m_dropped.fetch_add(1) == 0){
+            char errBuf[AV_ERROR_MAX_STRING_SIZE] = {0};
+            av_strerror(ret, errBuf, sizeof(errBuf));
+            QLOG_ERROR() << "timeshift write packet fail" << errBuf;
+        }
+        return;
+    }
+    // 读取端只能读到已写入文件的部分, 攒够数据或时长后再写入, 避免每个包一次系统调用
+    int64_t now = av_gettime_relative();
+    int64_t written = avio_tell(m_outCtx->pb);
+    int64_t flushed = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        flushed = m_segments.back().size;
+    }
+    bool flush = m_waitingReaders.load() > 0 || written - flushed >= TIMESHIFT_FLUSH_BYTES ||
+            now - m_lastFlushTime >= (int64_t)(TIMESHIFT_FLUSH_INTERVAL * 1000000);
+    if(flush){
+        avio_flush(m_outCtx->pb);
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Segment& segment = m_segments.back();
+        if(flush) segment.size = written;
+        if(segment.startPts == AV_NOPTS_VALUE) segment.startPts = pts;
+        segment.endPts = std::max(segment.endPts, pts);
+    }
+    if(flush){
+        m_lastFlushTime = now;
+        m_dataCond.notify_all();
+    }
+}
+
+bool TimeshiftRecorder::openSegment()
+{
+    QString path = QString("%1/seg_%2.ts").arg(m_dir).arg(m_segmentCount++, 5, 10, QChar('0'));
+    int ret = avio_open(&m_outCtx->pb, path.toUtf8().constData(), AVIO_FLAG_WRITE);
+    if(ret < 0){
+        char errBuf[AV_ERROR_MAX_STRING_SIZE] = {0};
+        av_strerror(ret, errBuf, sizeof(errBuf));
+        QLOG_ERROR() << "open timeshift segment fail:" << path << errBuf;
+        m_outCtx->pb = nullptr;
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Segment segment;
+    segment.path = path;
+    segment.offset = m_segments.empty() ? 0 : m_segments.back().offset + m_segments.back().size;
+    segment.size = 0;
+    segment.startPts = AV_NOPTS_VALUE;
+    segment.endPts = m_segments.empty() ? AV_NOPTS_VALUE : m_segments.back().endPts;
+    m_segments.push_back(segment);
+    return true;
+}
+
+void TimeshiftRecorder::trimSegments()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    // 至少保留正在写的分段和上一个完整分段
+    while(m_segments.size() > 2){
+        const Segment& front = m_segments.front();
+        const Segment& back = m_segments.back();
+        int64_t bytes = back.offset + back.size - front.offset;
+        int64_t duration = front.startPts == AV_NOPTS_VALUE ? 0 : back.endPts - front.startPts;
+        if(duration <= m_window && bytes <= m_maxBytes) break;
+        if(!QFile::remove(front.path)){
+            m_pendingRemoval << front.path;
+        }
+        m_segments.pop_front();
+    }
+    QStringList pending;
+    pending.swap(m_pendingRemoval);
+    for(const QString& path : pending){
+        if(QFile::exists(path) && !QFile::remove(path)) m_pendingRemoval << path;
+    }
+}
+
+void TimeshiftRecorder::removeFiles()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_segments.clear();
+    m_pendingRemoval.clear();
+    if(!m_dir.isEmpty()){
+        QDir(m_dir).removeRecursively();
+        m_dir.clear();
+    }
+}
@@ -0,0 +1,106 @@
+#ifndef TIMESHIFTRECORDER_H
+#define TIMESHIFTRECORDER_H
+
+#include <QString>
+#include <QStringList>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include "SpscRing.h"
+#include "PipelineThreads.h"
+
+extern "C"{
+#include <libavformat/avformat.h>
+}
+
+// 分段时长(秒), 在视频关键帧处切分, 每段开头都有PAT/PMT和关键帧
+#define TIMESHIFT_SEGMENT_DURATION 4.0
+// 默认保留的时长(秒)和磁盘用量上限, 超出时删除最早的分段
+#define TIMESHIFT_WINDOW 1800.0
+#define TIMESHIFT_MAX_BYTES (2LL * 1024 * 1024 * 1024)
+// 待写入的包队列, 满时丢包, 不阻塞读包线程
+#define TIMESHIFT_QUEUE_SIZE 1024
+// 复用器的输出攒到该字节数或时长(秒)再写入文件, 读取端追上写入位置时立即写入
+#define TIMESHIFT_FLUSH_BYTES (256 * 1024)
+#define TIMESHIFT_FLUSH_INTERVAL 0.2
+
+/**
+ * @brief 直播时移录制
+ * 读包线程push()包的引用, 写线程不重新编码, 直接复用为分段的MPEG-TS文件
+ * 各分段按写入顺序拼接成一个连续的字节流, 通过read()读取, 最早的分段被删除后起点随之后移
+ * 时间戳与输入一致(微秒), 可以直接按播放时钟跳转
+ */
+class TimeshiftRecorder : public ForbidCopy
+{
+public:
+    TimeshiftRecorder();
+    ~TimeshiftRecorder();
+
+    /**
+     * @brief 按输入的音视频流创建复用器并启动写线程
+     * @param window 保留的时长(秒)
+     * @param maxBytes 磁盘用量上限
+     */
+    bool start(const AVFormatContext *input, int audioIndex, int videoIndex,
+               double window = TIMESHIFT_WINDOW, int64_t maxBytes = TIMESHIFT_MAX_BYTES);
+    // 停止写线程并删除录制的文件
+    void stop();
+    inline bool isRecording() const {return m_outCtx != nullptr;}
+
+    // 读包线程调用, 只增加包的引用计数, 不阻塞
+    void push(const AVPacket *pkt);
+
+    // 已录制的时间范围(微秒), 还没有数据时返回false
+    bool range(int64_t *start, int64_t *end) const;
+    // 不晚于target的最后一个分段的起始字节位置
+    int64_t offsetFor(int64_t target) const;
+    /**
+     * @brief 从连续字节流的*pos处读取, *pos早于已保留的范围时移到最早的分段
+     * @return 读到的字节数, 暂时没有新数据返回0, 失败返回负的错误码
+     */
+    int read(int64_t *pos, uint8_t *buf, int size);
+    // 等待pos之后有新数据写入, 超时或停止时返回false
+    bool waitData(int64_t pos, int timeoutMs);
+
+private:
+    struct Segment{
+        QString path;
+        int64_t offset; // 在连续字节流中的起点
+        int64_t size;
+        int64_t startPts; // 微秒
+        int64_t endPts;
+    };
+
+    void writeLoop();
+    void writePacket(AVPacket *pkt);
+    bool openSegment();
+    // 删除超出保留时长或磁盘上限的分段
+    void trimSegments();
+    void removeFiles();
+
+    AVFormatContext *m_outCtx;
+    // 输入流序号 -> 输出流序号, 其他流为-1
+    std::vector<int> m_streamMap;
+    std::vector<AVRational> m_inputTimeBase;
+    int m_videoOutIndex;
+    QString m_dir;
+    int m_segmentCount;
+    int64_t m_window; // 微秒
+    int64_t m_maxBytes;
+    std::atomic<int64_t> m_dropped; // demux线程(队列满)和写线程(写失败)都会递增
+    int64_t m_lastFlushTime; // 微秒
+    std::atomic_int m_waitingReaders; // 阻塞在waitData()中的读取端
+
+    SpscRing<AVPacket*> m_queue;
+    std::atomic_bool m_exit;
+    PipelineThreads m_thread;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_dataCond;
+    std::deque<Segment> m_segments; // 最后一个为正在写的分段
+    QStringList m_pendingRemoval; // 删除失败(例如正被读取)的文件, 之后重试
+};
+
+#endif // TIMESHIFTRECORDER_H
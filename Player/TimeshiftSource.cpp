@@ -0,0 +1,69 @@
+#include "TimeshiftSource.h"
+#include <cstdio>
+
+extern "C"{
+#include <libavutil/error.h>
+}
+
+TimeshiftSource::TimeshiftSource(TimeshiftRecorder *recorder)
+    : m_recorder(recorder),
+      m_pos(0),
+      m_abort(false),
+      m_interrupt(nullptr),
+      m_interruptOpaque(nullptr)
+{
+}
+
+TimeshiftSource::~TimeshiftSource()
+{
+    freeAVIOContext();
+    close();
+}
+
+bool TimeshiftSource::open(const QString &url)
+{
+    Q_UNUSED(url);
+    m_pos = 0;
+    m_abort.store(false);
+    return m_recorder->isRecording();
+}
+
+void TimeshiftSource::close()
+{
+    m_pos = 0;
+}
+
+void TimeshiftSource::interrupt()
+{
+    m_abort.store(true);
+}
+
+void TimeshiftSource::setInterruptCallback(int (*callback)(void *), void *opaque)
+{
+    m_interrupt = callback;
+    m_interruptOpaque = opaque;
+}
+
+int TimeshiftSource::read(uint8_t *buf, int size)
+{
+    while(true){
+        int ret = m_recorder->read(&m_pos, buf, size);
+        if(ret != 0) return ret;
+        // 已追上录制位置, 等待写线程写入
+        if(m_abort.load() || (m_interrupt && m_interrupt(m_interruptOpaque))) return AVERROR_EXIT;
+        m_recorder->waitData(m_pos, TIMESHIFT_POLL_MS);
+    }
+}
+
+int64_t TimeshiftSource::seek(int64_t offset, int whence)
+{
+    int64_t pos = 0;
+    switch(whence){
+    case SEEK_SET: pos = offset; break;
+    case SEEK_CUR: pos = m_pos + offset; break;
+    default: return AVERROR(ENOSYS);
+    }
+    if(pos < 0) return AVERROR(EINVAL);
+    m_pos = pos; // 早于保留范围时由下次读取后移
+    return m_pos;
+}
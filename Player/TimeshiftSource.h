@@ -0,0 +1,40 @@
+#ifndef TIMESHIFTSOURCE_H
+#define TIMESHIFTSOURCE_H
+
+#include <atomic>
+#include "IOSource.h"
+#include "TimeshiftRecorder.h"
+
+// 等待新录制数据时检查中断回调的间隔(毫秒)
+#define TIMESHIFT_POLL_MS 50
+
+/**
+ * @brief 把TimeshiftRecorder正在录制的分段当作一个不断增长的TS文件读取
+ * 读到录制末尾时等待新数据, 相当于延迟播放直播; 读位置所在的分段被删除后从最早保留的分段继续
+ * 总长度未知, 跳转只支持SEEK_SET/SEEK_CUR
+ */
+class TimeshiftSource : public IOSource
+{
+public:
+    explicit TimeshiftSource(TimeshiftRecorder *recorder);
+    ~TimeshiftSource();
+
+    bool open(const QString& url) override;
+    void close() override;
+    int read(uint8_t *buf, int size) override;
+    int64_t seek(int64_t offset, int whence) override;
+    inline int64_t size() const override {return -1;}
+    void interrupt() override;
+
+    // 等待新数据期间调用, 返回非0时read()返回AVERROR_EXIT
+    void setInterruptCallback(int (*callback)(void*), void *opaque);
+
+private:
+    TimeshiftRecorder *m_recorder;
+    int64_t m_pos;
+    std::atomic_bool m_abort;
+    int (*m_interrupt)(void*);
+    void *m_interruptOpaque;
+};
+
+#endif // TIMESHIFTSOURCE_H
@@ -0,0 +1,67 @@
+#ifndef VIDEOFRAME_H
+#define VIDEOFRAME_H
+
+extern "C"{
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+}
+
+/**
+ * @brief 送往渲染端的视频帧, 只增加AVFrame缓冲区的引用计数, 不拷贝数据
+ * 解码器的缓冲在最后一个引用释放后才会被复用, 渲染线程可以直接从中上传纹理
+ * 通过QSharedPointer在线程间传递
+ */
+class VideoFrame{
+public:
+    explicit VideoFrame(const AVFrame *frame)
+        :m_frame(av_frame_alloc())
+    {
+        if(m_frame && av_frame_ref(m_frame, frame) < 0){
+            av_frame_free(&m_frame);
+        }
+    }
+
+    ~VideoFrame()
+    {
+        av_frame_free(&m_frame);
+    }
+
+    VideoFrame(const VideoFrame&) = delete;
+    VideoFrame& operator=(const VideoFrame&) = delete;
+
+    inline bool isValid() const {return m_frame != nullptr;}
+    inline const uint8_t *data(int plane) const {return m_frame->data[plane];}
+    // 行字节数, 可能大于可见宽度
+    inline int lineSize(int plane) const {return m_frame->linesize[plane];}
+    inline int width() const {return m_frame->width;}
+    inline int height() const {return m_frame->height;}
+    inline int format() const {return m_frame->format;}
+    inline const AVFrame *avFrame() const {return m_frame;}
+
+    // 渲染端可以直接上传的格式: 平面4:2:0/4:2:2/4:4:4(8位/10位), 半平面NV12/P010
+    // 其他格式由播放器转换为AV_PIX_FMT_YUV420P
+    static bool isNativeFormat(int format)
+    {
+        switch(format){
+        case AV_PIX_FMT_YUV420P:
+        case AV_PIX_FMT_YUVJ420P:
+        case AV_PIX_FMT_YUV422P:
+        case AV_PIX_FMT_YUVJ422P:
+        case AV_PIX_FMT_YUV444P:
+        case AV_PIX_FMT_YUVJ444P:
+        case AV_PIX_FMT_YUV420P10LE:
+        case AV_PIX_FMT_YUV422P10LE:
+        case AV_PIX_FMT_YUV444P10LE:
+        case AV_PIX_FMT_NV12:
+        case AV_PIX_FMT_P010LE:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+private:
+    AVFrame *m_frame;
+};
+
+#endif // VIDEOFRAME_H
@@ -0,0 +1,29 @@
+#ifndef VIDEOPRESENTER_H
+#define VIDEOPRESENTER_H
+
+#include <QSharedPointer>
+#include <functional>
+
+class VideoFrame;
+
+/**
+ * @brief 独立渲染线程的接口, 视频线程提前提交帧及其期望显示的时刻
+ * 渲染线程按显示器的垂直同步节奏显示, 并回报每帧实际显示的时刻, 由播放器据此更新视频时钟
+ * 时刻均为av_gettime_relative()的秒数
+ */
+class VideoPresenter
+{
+public:
+    // 回调在渲染线程中执行
+    using PresentCallback = std::function<void(double pts, double presentTime)>;
+
+    virtual ~VideoPresenter() = default;
+
+    // 视频线程调用, 帧在targetTime所在的垂直同步周期显示, 更早到期的帧被丢弃
+    virtual void submitFrame(QSharedPointer<VideoFrame> frame, double pts, double targetTime) = 0;
+    // 跳转或停止时丢弃尚未显示的帧
+    virtual void flushFrames() = 0;
+    virtual void setPresentCallback(PresentCallback callback) = 0;
+};
+
+#endif // VIDEOPRESENTER_H
@@ -0,0 +1,85 @@
+#ifndef MEMORYBUDGET_H
+#define MEMORYBUDGET_H
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include "ThreadPool.h"
+
+// 进程内所有Decoder包队列共用的内存预算, 默认256MB
+#define MEMORY_BUDGET_DEFAULT (256LL * 1024 * 1024)
+
+/**
+ * @brief 包队列的全局内存预算
+ * 入队时 acquire(), 出队时 release()
+ * release() 会唤醒等待预算或队列空位的demux线程
+ */
+class MemoryBudget : public ForbidCopy
+{
+public:
+    static MemoryBudget& instance()
+    {
+        static MemoryBudget ins;
+        return ins;
+    }
+
+    inline void setLimit(int64_t bytes)
+    {
+        m_limit.store(bytes);
+        wakeAll();
+    }
+    inline int64_t limit() const {return m_limit.load();}
+    inline int64_t used() const {return m_used.load();}
+    inline bool exceeded() const {return m_used.load() >= m_limit.load();}
+
+    inline void acquire(int64_t bytes)
+    {
+        m_used.fetch_add(bytes);
+    }
+    void release(int64_t bytes)
+    {
+        m_used.fetch_sub(bytes);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(m_waiters.load(std::memory_order_relaxed) > 0){
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_cond.notify_all();
+        }
+    }
+
+    /**
+     * @brief 阻塞到cond()成立或interrupted()为真, 每次release()后重新判断
+     * @return 条件满足返回true, 被打断返回false
+     */
+    template<class Cond, class Pred>
+    bool wait(Cond cond, Pred interrupted)
+    {
+        if(cond()) return true;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_waiters.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        m_cond.wait(lock, [&](){return cond() || interrupted();});
+        m_waiters.fetch_sub(1);
+        return cond();
+    }
+    void wakeAll()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_cond.notify_all();
+    }
+
+private:
+    MemoryBudget()
+        :m_limit(MEMORY_BUDGET_DEFAULT),
+          m_used(0),
+          m_waiters(0)
+    {}
+
+private:
+    std::atomic<int64_t> m_limit;
+    std::atomic<int64_t> m_used;
+    std::atomic_int m_waiters;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+};
+
+#endif // MEMORYBUDGET_H
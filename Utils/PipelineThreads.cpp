@@ -0,0 +1,26 @@
+#include "PipelineThreads.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__) || defined(__APPLE__)
+#include <pthread.h>
+#endif
+
+void PipelineThreads::setCurrentThreadName(const std::string &name)
+{
+#if defined(_WIN32)
+    // Windows 10 1607之后才有, 运行时查找, 旧系统上不命名
+    typedef HRESULT (WINAPI *SetThreadDescriptionFunc)(HANDLE, PCWSTR);
+    static SetThreadDescriptionFunc setThreadDescription = reinterpret_cast<SetThreadDescriptionFunc>(
+                reinterpret_cast<void*>(GetProcAddress(GetModuleHandleW(L"kernel32.dll"), "SetThreadDescription")));
+    if(!setThreadDescription) return;
+    std::wstring wname(name.begin(), name.end());
+    setThreadDescription(GetCurrentThread(), wname.c_str());
+#elif defined(__APPLE__)
+    pthread_setname_np(name.substr(0, 15).c_str());
+#elif defined(__linux__)
+    pthread_setname_np(pthread_self(), name.substr(0, 15).c_str()); // linux限制16字节
+#else
+    (void)name;
+#endif
+}
@@ -0,0 +1,73 @@
+#ifndef PIPELINETHREADS_H
+#define PIPELINETHREADS_H
+
+#include <thread>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <functional>
+#include "ThreadPool.h"
+
+/**
+ * @brief 播放流水线中常驻线程(demux, 音视频解码, 视频渲染)的持有者
+ * 与ThreadPool不同, 每个阶段独占一个具名线程, 退出时joinAll()等待各阶段真正结束,
+ * 之后才能安全地释放它们使用的资源
+ */
+class PipelineThreads : public ForbidCopy
+{
+public:
+    PipelineThreads() = default;
+    ~PipelineThreads()
+    {
+        joinAll();
+    }
+
+    // 启动一个阶段, name 会显示在调试器/性能分析工具中
+    void start(const std::string& name, std::function<void()> func)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stages.emplace_back(Stage{name, std::thread([name, func](){
+            setCurrentThreadName(name);
+            func();
+        })});
+    }
+
+    // 等待所有阶段结束, 调用前需先让各阶段的循环退出
+    void joinAll()
+    {
+        std::vector<Stage> stages;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            stages.swap(m_stages);
+        }
+        for(Stage& stage : stages){
+            if(!stage.thread.joinable()) continue;
+            if(stage.thread.get_id() == std::this_thread::get_id()){
+                stage.thread.detach(); // 阶段线程不能join自己
+            }
+            else{
+                stage.thread.join();
+            }
+        }
+    }
+
+    inline bool empty()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_stages.empty();
+    }
+
+private:
+    // 平台相关, 实现在PipelineThreads.cpp, 避免在头文件中引入windows.h
+    static void setCurrentThreadName(const std::string& name);
+
+    struct Stage{
+        std::string name;
+        std::thread thread;
+    };
+
+    std::mutex m_mutex;
+    std::vector<Stage> m_stages;
+};
+
+#endif // PIPELINETHREADS_H
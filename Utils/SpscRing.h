@@ -0,0 +1,162 @@
+#ifndef SPSCRING_H
+#define SPSCRING_H
+
+#include <atomic>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+// 缓存行大小, 读写索引分别独占一行, 避免生产者与消费者之间的伪共享
+#define SPSC_CACHE_LINE 64
+
+/**
+ * @brief 单生产者单消费者无锁环形队列
+ * 生产者: pushSlot() 取得可写槽位, 填充后 commitPush() 发布
+ * 消费者: peek() 读取槽位, 用完后 pop() 归还
+ * 读写索引通过 acquire/release 同步, 只有在队列空(满)需要等待时才会用到互斥锁
+ */
+template<typename T>
+class SpscRing
+{
+public:
+    explicit SpscRing(size_t capacity = 0)
+        :m_readIndex(0),
+          m_cachedPushIndex(0),
+          m_pushIndex(0),
+          m_cachedReadIndex(0),
+          m_waiters(0),
+          m_mask(0)
+    {
+        resize(capacity);
+    }
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    // 容量向上取整为2的幂, 只能在没有生产者和消费者时调用
+    void resize(size_t capacity)
+    {
+        size_t size = 1;
+        while(size < capacity) size <<= 1;
+        m_slots.clear();
+        m_slots.resize(size);
+        m_mask = size - 1;
+        m_readIndex.store(0, std::memory_order_relaxed);
+        m_pushIndex.store(0, std::memory_order_relaxed);
+        m_cachedPushIndex = 0;
+        m_cachedReadIndex = 0;
+    }
+
+    inline size_t capacity() const {return m_mask + 1;}
+    inline size_t size() const
+    {
+        size_t read = m_readIndex.load(std::memory_order_acquire);
+        size_t push = m_pushIndex.load(std::memory_order_acquire);
+        return push - read;
+    }
+    inline bool empty() const {return size() == 0;}
+    inline bool full() const {return size() >= capacity();}
+
+    // 生产者: 获取下一个可写槽位, 队列已满返回nullptr
+    T *pushSlot()
+    {
+        size_t push = m_pushIndex.load(std::memory_order_relaxed);
+        if(push - m_cachedReadIndex >= capacity()){
+            m_cachedReadIndex = m_readIndex.load(std::memory_order_acquire);
+            if(push - m_cachedReadIndex >= capacity()) return nullptr;
+        }
+        return &m_slots[push & m_mask];
+    }
+    // 生产者: 发布pushSlot()填充好的槽位
+    void commitPush()
+    {
+        m_pushIndex.store(m_pushIndex.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        notifyWaiters();
+    }
+
+    // 消费者: 读位置之后的第offset个元素, 数量不足返回nullptr
+    T *peek(size_t offset = 0)
+    {
+        size_t read = m_readIndex.load(std::memory_order_relaxed);
+        if(m_cachedPushIndex - read <= offset){
+            m_cachedPushIndex = m_pushIndex.load(std::memory_order_acquire);
+            if(m_cachedPushIndex - read <= offset) return nullptr;
+        }
+        return &m_slots[(read + offset) & m_mask];
+    }
+    // 消费者: 归还读位置的槽位
+    void pop()
+    {
+        m_readIndex.store(m_readIndex.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        notifyWaiters();
+    }
+
+    /**
+     * 阻塞等待, 不轮询: 条件满足或interrupted()为真时返回
+     * interrupted 用于退出/跳转等外部事件, 置位后需调用wakeAll()
+     * @return 条件满足返回true, 被打断返回false
+     */
+    // 消费者: 等待队列中至少有count个元素
+    template<class Pred>
+    bool waitReadable(size_t count, Pred interrupted)
+    {
+        return waitUntil([&](){return size() >= count;}, interrupted);
+    }
+    // 生产者: 等待队列有空位
+    template<class Pred>
+    bool waitWritable(Pred interrupted)
+    {
+        return waitUntil([&](){return !full();}, interrupted);
+    }
+    // 生产者: 等待消费者取空队列
+    template<class Pred>
+    bool waitDrained(Pred interrupted)
+    {
+        return waitUntil([&](){return empty();}, interrupted);
+    }
+    // 唤醒所有阻塞在当前队列上的线程
+    void wakeAll()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_cond.notify_all();
+    }
+
+private:
+    template<class Cond, class Pred>
+    bool waitUntil(Cond cond, Pred interrupted)
+    {
+        if(cond()) return true;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_waiters.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        m_cond.wait(lock, [&](){return cond() || interrupted();});
+        m_waiters.fetch_sub(1);
+        return cond();
+    }
+
+    // 索引发布后检查是否有等待者, 没有等待者时不碰互斥锁
+    void notifyWaiters()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(m_waiters.load(std::memory_order_relaxed) > 0){
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_cond.notify_all();
+        }
+    }
+
+private:
+    // 消费者独占: 读索引及其缓存的写索引
+    alignas(SPSC_CACHE_LINE) std::atomic<size_t> m_readIndex;
+    size_t m_cachedPushIndex;
+    // 生产者独占: 写索引及其缓存的读索引
+    alignas(SPSC_CACHE_LINE) std::atomic<size_t> m_pushIndex;
+    size_t m_cachedReadIndex;
+    // 阻塞等待(慢路径)
+    alignas(SPSC_CACHE_LINE) std::atomic_int m_waiters;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+
+    std::vector<T> m_slots;
+    size_t m_mask;
+};
+
+#endif // SPSCRING_H
@@ -0,0 +1,63 @@
+#ifndef THREADBUDGET_H
+#define THREADBUDGET_H
+
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include "ThreadPool.h"
+
+// 留给GUI, SDL音频回调, demux及渲染等线程的核心数
+#define THREAD_BUDGET_RESERVED 2
+
+/**
+ * @brief 进程级的解码线程预算
+ * 各Decoder打开解码器前 acquire() 领取libavcodec内部线程数, 关闭时 release() 归还,
+ * 多个Decoder同时存在时(例如预加载下一个文件)也不会超过CPU核心数
+ */
+class ThreadBudget : public ForbidCopy
+{
+public:
+    static ThreadBudget& instance()
+    {
+        static ThreadBudget ins;
+        return ins;
+    }
+
+    inline int total() const {return m_total;}
+    inline int available() const {return m_available.load();}
+
+    /**
+     * @brief 领取线程, 预算不足时按剩余量分配, 至少分配1个
+     * 分配1个时libavcodec只在调用线程上解码, 不占用预算
+     * @param wanted 期望的线程数, <=0 表示取剩余的全部
+     * @return 实际分配的线程数
+     */
+    int acquire(int wanted)
+    {
+        int avail = m_available.load();
+        int granted = 1;
+        do{
+            granted = wanted > 0 ? std::min(wanted, avail) : avail;
+            if(granted <= 1) return 1;
+        }while(!m_available.compare_exchange_weak(avail, avail - granted));
+        return granted;
+    }
+    inline void release(int granted)
+    {
+        if(granted > 1) m_available.fetch_add(granted);
+    }
+
+private:
+    ThreadBudget()
+    {
+        int cores = (int)std::thread::hardware_concurrency();
+        m_total = std::max(1, cores - THREAD_BUDGET_RESERVED);
+        m_available.store(m_total);
+    }
+
+private:
+    int m_total;
+    std::atomic_int m_available;
+};
+
+#endif // THREADBUDGET_H
@@ -1,6 +1,8 @@
 #ifndef UTILS_H
 #define UTILS_H
 #include <QDir>
+#include <QStandardPaths>
+#include <QCryptographicHash>
 
 struct Utils
 {
@@ -17,6 +19,15 @@ struct Utils
             return result;
         }
     }
+
+    // 缓存目录下subDir中以key的哈希命名的文件路径, 目录创建失败返回空串
+    static QString cacheFilePath(const QString& subDir, const QString& key, const QString& suffix)
+    {
+        QString dirPath = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/" + subDir;
+        if(!mkDirs(dirPath)) return QString();
+        QString hash = QString::fromLatin1(QCryptographicHash::hash(key.toUtf8(), QCryptographicHash::Sha1).toHex());
+        return QString("%1/%2.%3").arg(dirPath).arg(hash).arg(suffix);
+    }
 };
 
 #endif // UTILS_H
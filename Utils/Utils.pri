@@ -1,8 +1,13 @@
 HEADERS += $$PWD/Utils.h \ \
     $$PWD/MsgBox.h \
-    $$PWD/ThreadPool.h
+    $$PWD/ThreadPool.h \
+    $$PWD/SpscRing.h \
+    $$PWD/MemoryBudget.h \
+    $$PWD/ThreadBudget.h \
+    $$PWD/PipelineThreads.h
 
 INCLUDEPATH += Utils
 
 SOURCES += \
-    $$PWD/MsgBox.cpp
+    $$PWD/MsgBox.cpp \
+    $$PWD/PipelineThreads.cpp
@@ -1,8 +1,12 @@
 HEADERS += $$PWD/opengl_widget.h \
+    $$PWD/video_renderer.h \
+    $$PWD/video_window.h \
     $$PWD/slider_pts.h \
     $$PWD/sound_slider.h
 
 SOURCES += $$PWD/opengl_widget.cpp \
+    $$PWD/video_renderer.cpp \
+    $$PWD/video_window.cpp \
     $$PWD/slider_pts.cpp \
     $$PWD/sound_slider.cpp
 
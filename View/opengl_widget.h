@@ -1,17 +1,15 @@
 #ifndef OPENGL_WIDGET_H
 #define OPENGL_WIDGET_H
 
-#include <QOpenGLFunctions>
 #include <QOpenGLWidget>
-#include <QOpenGLShaderProgram>
-#include <QOpenGLBuffer>
-#include <QOpenGLTexture>
 #include <QTimer>
-#include <Eigen/Dense>
+#include "video_renderer.h"
 
-class YUV422Frame;
+class VideoFrame;
+class VideoWindow;
+class VideoPresenter;
 
-class OpenGLWidget : public QOpenGLWidget, public QOpenGLFunctions
+class OpenGLWidget : public QOpenGLWidget
 {
     Q_OBJECT
 
@@ -19,56 +17,51 @@ public:
     explicit OpenGLWidget(QWidget* parent = nullptr);
     ~OpenGLWidget();
 
+    /**
+     * @brief 切换到独立渲染线程模式, 由嵌入的VideoWindow按垂直同步显示
+     * 渲染线程真正开始工作后发出presenterReady, 失败时移除窗口, 仍由showYUV()显示
+     */
+    void enableRenderThread();
+
 protected:
     virtual void initializeGL() override;
     virtual void paintGL() override;
     virtual void resizeGL(int w, int h) override;
+    virtual void resizeEvent(QResizeEvent *event) override;
     virtual void mouseReleaseEvent(QMouseEvent *event) override;
     virtual void mouseDoubleClickEvent(QMouseEvent *event) override;
 
 public slots:
-    void showYUV(QSharedPointer<YUV422Frame> frame);
+    // 帧数据写入像素缓冲对象并发起异步上传后即释放帧, paintGL只绑定纹理并绘制
+    void showYUV(QSharedPointer<VideoFrame> frame);
+    // 首帧到达前按视频尺寸和像素格式分配纹理存储
+    void prepareTextures(int width, int height, int format);
 
 signals:
+    // 渲染线程已启动, 交给AVPlayer::setVideoPresenter(), 之后帧不再经过showYUV()
+    void presenterReady(VideoPresenter *presenter);
     void mouseClicked();
     void mouseDoubleClicked();
 
 private:
-    QSharedPointer<YUV422Frame> m_frame;
-
-    // 顶点缓冲区对象
-    QOpenGLBuffer vbo;
-    // 着色管理器
-    QOpenGLShaderProgram *program;
-    //yuv分量位置
-    GLuint posUniformY;
-    GLuint posUniformU;
-    GLuint posUniformV;
-    // 用于传递变换矩阵
-    GLuint posUniformTransform;
+    // 渲染线程没有运行, 移除窗口退回GUI线程绘制
+    void disableRenderThread();
+    void onMouseReleased();
+    void onMouseDoubleClicked();
 
-    // 纹理
-    QOpenGLTexture *textureY = nullptr;
-    QOpenGLTexture *textureU = nullptr;
-    QOpenGLTexture *textureV = nullptr;
+    VideoRenderer m_renderer;
+    bool m_initialized = false;
+    // 上下文创建前到达的帧, 在首次paintGL时上传
+    QSharedPointer<VideoFrame> m_pendingFrame;
 
-    // 纹理ID, 失败返回0
-    GLuint m_idY, m_idU, m_idV;
+    // 渲染线程模式下的视频窗口及其容器
+    VideoWindow *m_window = nullptr;
+    QWidget *m_container = nullptr;
 
     QTimer m_timer;
 
     bool m_isDoubleClick;
-    int m_dstWidth, m_dstHeight;
-    float m_srcAspectRatio = 1.f;
-    float m_dstAspectRatio = 1.f;
-    // 00 01 02 03
-    // 10 11 12 13
-    // 20 21 22 33
-    // 30 31 32 33
-    // 00: x 方向的缩放因子    10: y 方向的剪切因子  20: z 方向的剪切因子
-    // 01: x 方向的剪切      11: y 方向的缩放因子   21: z 方向的缩放因子
-    // 02: x 方向的平移      12: y 方向的平移     22: z 方向的深度
-    Eigen::Matrix4f m_transform;
+    int m_dstWidth = 0, m_dstHeight = 0;
 };
 
 #endif // OPENGL_WIDGET_H
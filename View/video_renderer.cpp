@@ -0,0 +1,364 @@
+#include "video_renderer.h"
+#include "VideoFrame.h"
+#include <QsLog.h>
+#include <cstring>
+
+extern "C"{
+#include <libavutil/common.h>
+#include <libavutil/pixdesc.h>
+}
+
+#define VERTEXIN 0
+#define TEXTUREIN 1
+
+// 应用变换矩阵计算顶点在屏幕上的位置
+// 将纹理坐标传递给片段着色器以用于纹理采样。
+// gl_Postion 屏幕展现的位置
+const char* vertexShade = R"(
+        #version 450 core
+        layout(location = 0) in vec2 vertexIn;
+        layout(location = 1) in vec2 textureIn;
+        layout(location = 0) out vec2 textureOut;
+        uniform mat4 transform;
+        void main(void)
+        {
+            gl_Position = transform * vec4(vertexIn, 0.0, 1.0);
+            textureOut = textureIn;
+        }
+)";
+
+// R = Y + U + V
+// G = 0 - 0.39465U + 2.03211V
+// B = 1.13983Y - 0.58060U + 0
+// 平面格式: Y/U/V各一张纹理, 色度纹理按实际尺寸分配, 采样时由纹理过滤完成上采样
+// scale: 10位数据存放在16位纹理中, 采样值需放大到[0, 1]
+const char* fragShade = R"(
+        #version 450 core
+        layout(location = 0) out vec4 o_Color;
+        layout(location = 0) in vec2 textureOut;
+
+        uniform sampler2D tex_y;
+        uniform sampler2D tex_u;
+        uniform sampler2D tex_v;
+        uniform float scale;
+        void main(void)
+        {
+            vec3 yuv;
+            vec3 rgb;
+            yuv.x = texture2D(tex_y, textureOut).r * scale;
+            yuv.y = texture2D(tex_u, textureOut).r * scale - 0.5;
+            yuv.z = texture2D(tex_v, textureOut).r * scale - 0.5;
+            rgb = mat3(1, 1, 1,
+                        0, -0.39465, 2.03211,
+                        1.13983, -0.58060, 0) * yuv;
+            o_Color = vec4(rgb, 1);
+        }
+)";
+
+// 半平面格式(NV12/P010): U/V交错存放在一张双通道纹理中
+const char* fragShadeSemiPlanar = R"(
+        #version 450 core
+        layout(location = 0) out vec4 o_Color;
+        layout(location = 0) in vec2 textureOut;
+
+        uniform sampler2D tex_y;
+        uniform sampler2D tex_uv;
+        uniform float scale;
+        void main(void)
+        {
+            vec3 yuv;
+            vec3 rgb;
+            yuv.x = texture2D(tex_y, textureOut).r * scale;
+            yuv.yz = texture2D(tex_uv, textureOut).rg * scale - vec2(0.5, 0.5);
+            rgb = mat3(1, 1, 1,
+                        0, -0.39465, 2.03211,
+                        1.13983, -0.58060, 0) * yuv;
+            o_Color = vec4(rgb, 1);
+        }
+)";
+
+VideoRenderer::VideoRenderer()
+    :m_transform(Eigen::Matrix4f::Identity())
+{
+}
+
+bool VideoRenderer::initialize()
+{
+    initializeOpenGLFunctions();
+    //glClearColor(0.2f, 0.20f, 0.28f, 1.0f);
+    glClearColor(0.180, 0.180, 0.212, 0.0);
+    // 省去被遮挡物的渲染开销
+    glEnable(GL_DEPTH_TEST);
+    static const GLfloat vertices[] = {
+        // 顶点坐标
+        -1.0f, -1.0f,
+        -1.0f, +1.0f,
+        +1.0f, +1.0f,
+        +1.0f, -1.0f,
+        // 纹理坐标
+        0.0f, 1.0f,
+        0.0f, 0.0f,
+        1.0f, 0.0f,
+        1.0f, 1.0f,
+    };
+
+    vbo.create();
+    vbo.bind();
+    vbo.allocate(vertices, sizeof(vertices));
+
+    static const char *const planarNames[3] = {"tex_y", "tex_u", "tex_v"};
+    static const char *const semiPlanarNames[3] = {"tex_y", "tex_uv", nullptr};
+    if(!createProgram(&m_planarProgram, fragShade, planarNames) ||
+            !createProgram(&m_semiPlanarProgram, fragShadeSemiPlanar, semiPlanarNames)){
+        return false;
+    }
+    QOpenGLShaderProgram *program = m_planarProgram.shader;
+    if(!program->bind()){
+        QLOG_ERROR() << "program bind error";
+        return false;
+    }
+
+    // 顶点属性位置在两个变体中相同, 只需设置一次
+    program->enableAttributeArray(VERTEXIN);
+    program->enableAttributeArray(TEXTUREIN);
+    program->setAttributeBuffer(VERTEXIN, GL_FLOAT, 0, 2, 2 * sizeof(GLfloat));
+    program->setAttributeBuffer(TEXTUREIN, GL_FLOAT, 8 * sizeof(GLfloat), 2, 2 * sizeof(GLfloat));
+
+    textureY = new QOpenGLTexture(QOpenGLTexture::Target2D);
+    textureU = new QOpenGLTexture(QOpenGLTexture::Target2D);
+    textureV = new QOpenGLTexture(QOpenGLTexture::Target2D);
+    textureY->create();
+    textureU->create();
+    textureV->create();
+    m_idY = textureY->textureId();
+    m_idU = textureU->textureId();
+    m_idV = textureV->textureId();
+    for(PixelBuffer& pbo : m_pixelBuffers){
+        glGenBuffers(1, &pbo.id);
+    }
+    return true;
+}
+
+void VideoRenderer::destroy()
+{
+    vbo.destroy();
+    QOpenGLTexture **textures[3] = {&textureY, &textureU, &textureV};
+    for(QOpenGLTexture **texture : textures){
+        if(*texture){
+            (*texture)->destroy();
+            delete *texture;
+            *texture = nullptr;
+        }
+    }
+    for(PixelBuffer& pbo : m_pixelBuffers){
+        if(pbo.fence) glDeleteSync(pbo.fence);
+        if(pbo.id) glDeleteBuffers(1, &pbo.id);
+        pbo = PixelBuffer();
+    }
+    delete m_planarProgram.shader;
+    delete m_semiPlanarProgram.shader;
+    m_planarProgram = ShaderProgram();
+    m_semiPlanarProgram = ShaderProgram();
+    m_textureWidth = 0;
+    m_textureHeight = 0;
+    m_textureFormat = -1;
+    m_frameUploaded = false;
+}
+
+bool VideoRenderer::createProgram(ShaderProgram *program, const char *fragment, const char *const names[3])
+{
+    program->shader = new QOpenGLShaderProgram;
+    program->shader->addShaderFromSourceCode(QOpenGLShader::Vertex, vertexShade);
+    program->shader->addShaderFromSourceCode(QOpenGLShader::Fragment, fragment);
+    // 即顶点着色器in变量的传递
+    program->shader->bindAttributeLocation("vertexIn", VERTEXIN);
+    program->shader->bindAttributeLocation("textureIn", TEXTUREIN);
+    if(!program->shader->link()){
+        QLOG_ERROR() << "program link error";
+        return false;
+    }
+    for(int i = 0; i < 3; i++){
+        program->texture[i] = names[i] ? program->shader->uniformLocation(names[i]) : -1;
+    }
+    program->transform = program->shader->uniformLocation("transform");
+    program->scale = program->shader->uniformLocation("scale");
+    return true;
+}
+
+VideoRenderer::TextureLayout VideoRenderer::textureLayout(int format)
+{
+    TextureLayout layout;
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get((AVPixelFormat)format);
+    if(!desc || !VideoFrame::isNativeFormat(format)) return layout;
+    layout.planes = av_pix_fmt_count_planes((AVPixelFormat)format);
+    layout.chromaShiftW = desc->log2_chroma_w;
+    layout.chromaShiftH = desc->log2_chroma_h;
+    layout.bytesPerSample = desc->comp[0].depth > 8 ? 2 : 1;
+    // 例如10位低位对齐: 65535 / 1023; P010高位对齐: 65535 / (1023 << 6)
+    float maxValue = layout.bytesPerSample == 2 ? 65535.f : 255.f;
+    layout.scale = maxValue / (float)(((1 << desc->comp[0].depth) - 1) << desc->comp[0].shift);
+    return layout;
+}
+
+void VideoRenderer::prepareTextures(int width, int height, int format)
+{
+    if(width <= 0 || height <= 0) return;
+    if(width == m_textureWidth && height == m_textureHeight && format == m_textureFormat) return;
+    allocateTextures(width, height, format);
+}
+
+void VideoRenderer::draw(int width, int height)
+{
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    if(!m_frameUploaded || width <= 0 || height <= 0) return;
+    float srcAspectRatio = (float)m_textureWidth / (float)m_textureHeight;
+    float dstAspectRatio = (float)width / (float)height;
+
+    if(srcAspectRatio <= dstAspectRatio){ // 需要变宽
+        float dstWMRatio = srcAspectRatio * height;
+        m_transform(0, 0) = dstWMRatio / width;
+        m_transform(1, 1) = 1.f;
+    }
+    else{
+        float dstHRatio = width / srcAspectRatio;
+        m_transform(0, 0) = 1.f;
+        m_transform(1, 1) = dstHRatio / height;
+    }
+
+    // 纹理已由uploadFrame()更新, 这里只绑定并绘制
+    const GLuint ids[3] = {m_idY, m_idU, m_idV};
+    for(int i = 0; i < m_layout.planes; i++){
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_2D, ids[i]);
+    }
+
+    const ShaderProgram& program = m_layout.planes == 2 ? m_semiPlanarProgram : m_planarProgram;
+    program.shader->bind();
+
+    /**
+     * @brief glUniformMatrix4fv 向当前活动着色器程序的 uniform 变量上传一个 4x4 矩阵
+     * @param 1 要传递的矩阵数量
+     * @param false 是否要转置矩阵
+     * @param data 要上传的矩阵数据的指针
+     */
+    glUniformMatrix4fv(program.transform, 1, GL_FALSE, m_transform.data());
+    glUniform1f(program.scale, m_layout.scale);
+
+    //Y 纹理绑定到纹理单元 GL_TEXTURE0, 其余分量依次绑定
+    for(int i = 0; i < m_layout.planes; i++){
+        glUniform1i(program.texture[i], i);
+    }
+    //使用顶点数组方式绘制图形
+    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+}
+
+void VideoRenderer::allocateTextures(int width, int height, int format)
+{
+    m_textureWidth = width;
+    m_textureHeight = height;
+    m_textureFormat = format;
+    m_frameUploaded = false;
+    m_layout = textureLayout(format);
+    if(m_layout.planes == 0){
+        QLOG_ERROR() << "unsupported pixel format for rendering:" << format;
+        return;
+    }
+    QOpenGLTexture *textures[3] = {textureY, textureU, textureV};
+    GLuint *ids[3] = {&m_idY, &m_idU, &m_idV};
+    for(int i = 0; i < m_layout.planes; i++){
+        // 不可变存储不能重新指定尺寸, 尺寸或格式变化时换用新的纹理对象
+        textures[i]->destroy();
+        textures[i]->create();
+        *ids[i] = textures[i]->textureId();
+        // 色度分量按格式的下采样比例缩小, 向上取整
+        int planeWidth = i == 0 ? width : AV_CEIL_RSHIFT(width, m_layout.chromaShiftW);
+        int planeHeight = i == 0 ? height : AV_CEIL_RSHIFT(height, m_layout.chromaShiftH);
+        bool interleaved = m_layout.planes == 2 && i == 1;
+        GLint internalFormat = m_layout.bytesPerSample == 2 ? (interleaved ? GL_RG16 : GL_R16)
+                                                            : (interleaved ? GL_RG8 : GL_R8);
+        glActiveTexture(GL_TEXTURE0 + i);
+        // 绑定分量纹理id, 到激活纹理单元
+        glBindTexture(GL_TEXTURE_2D, *ids[i]);
+        /**
+         * @brief glTexStorage2D 为二维纹理分配不可变存储, 之后只通过glTexSubImage2D更新数据
+         * @param GL_TEXTURE_2D 指定创建的纹理类型
+         * @param 1 多级渐远纹理的级数, 只有基本级别
+         * @param internalFormat 纹理的内部格式 单通道(交错的UV为双通道), 8位或16位
+         * @param w,h 纹理宽高
+         */
+        glTexStorage2D(GL_TEXTURE_2D, 1, internalFormat, planeWidth, planeHeight);
+        // 纹理的放大(缩小)过滤方法, 线性过滤(根据周围的像素进行线性插值，从而获得更平滑的视觉效果
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        // 纹理在水平(垂直)方向, S轴(T轴)的包裹方式, 夹紧到边缘
+        // 纹理坐标超出 [0, 1] 的范围，OpenGL 会使用边缘的颜色而不是重复纹理。
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+}
+
+void VideoRenderer::uploadFrame(const VideoFrame *frame)
+{
+    if(frame->width() != m_textureWidth || frame->height() != m_textureHeight || frame->format() != m_textureFormat){
+        allocateTextures(frame->width(), frame->height(), frame->format());
+    }
+    if(m_layout.planes == 0) return;
+
+    // 各分量保留解码缓冲的行字节数连续存放, 起点按64字节对齐
+    int planeWidths[3] = {0};
+    int planeHeights[3] = {0};
+    GLintptr offsets[3] = {0};
+    GLsizeiptr total = 0;
+    for(int i = 0; i < m_layout.planes; i++){
+        planeWidths[i] = i == 0 ? m_textureWidth : AV_CEIL_RSHIFT(m_textureWidth, m_layout.chromaShiftW);
+        planeHeights[i] = i == 0 ? m_textureHeight : AV_CEIL_RSHIFT(m_textureHeight, m_layout.chromaShiftH);
+        offsets[i] = total;
+        total += FFALIGN((GLsizeiptr)frame->lineSize(i) * planeHeights[i], 64);
+    }
+
+    PixelBuffer& pbo = m_pixelBuffers[m_pixelBufferIndex];
+    m_pixelBufferIndex = (m_pixelBufferIndex + 1) % PBO_RING_SIZE;
+    bool signaled = true;
+    if(pbo.fence){
+        // 该槽位上次的上传通常早已完成, 不会真正等待
+        GLenum ret = glClientWaitSync(pbo.fence, GL_SYNC_FLUSH_COMMANDS_BIT, PBO_FENCE_TIMEOUT);
+        signaled = ret == GL_ALREADY_SIGNALED || ret == GL_CONDITION_SATISFIED;
+        glDeleteSync(pbo.fence);
+        pbo.fence = nullptr;
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo.id);
+    if(pbo.size < total || !signaled){
+        // 超时或等待失败时GPU可能仍在读取, 重新分配存储, 旧存储由驱动在读取完成后释放
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, FFMAX(pbo.size, total), nullptr, GL_STREAM_DRAW);
+        pbo.size = FFMAX(pbo.size, total);
+    }
+    // 已由栅栏保证驱动不再读取该缓冲(或刚重新分配), 映射时不需要同步
+    uint8_t *dst = static_cast<uint8_t*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, total,
+                                         GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+    if(!dst){
+        QLOG_ERROR() << "map pixel buffer fail";
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        return;
+    }
+    for(int i = 0; i < m_layout.planes; i++){
+        memcpy(dst + offsets[i], frame->data(i), (size_t)frame->lineSize(i) * planeHeights[i]);
+    }
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+    // 绑定了像素缓冲对象时数据参数为缓冲内的偏移, 由驱动异步拷贝到纹理
+    const GLuint ids[3] = {m_idY, m_idU, m_idV};
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for(int i = 0; i < m_layout.planes; i++){
+        int components = m_layout.planes == 2 && i == 1 ? 2 : 1;
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_2D, ids[i]);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, frame->lineSize(i) / (m_layout.bytesPerSample * components));
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, planeWidths[i], planeHeights[i], components == 2 ? GL_RG : GL_RED,
+                        m_layout.bytesPerSample == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE,
+                        reinterpret_cast<const void*>(offsets[i]));
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    pbo.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    m_frameUploaded = true;
+}
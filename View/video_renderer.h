@@ -0,0 +1,97 @@
+#ifndef VIDEO_RENDERER_H
+#define VIDEO_RENDERER_H
+
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLBuffer>
+#include <QOpenGLTexture>
+#include <Eigen/Dense>
+
+// 像素缓冲对象环的槽位数, 上传未完成的槽位等待其栅栏后再复用
+#define PBO_RING_SIZE 3
+// 等待像素缓冲对象栅栏的超时, 纳秒
+#define PBO_FENCE_TIMEOUT 100000000
+
+class VideoFrame;
+
+/**
+ * @brief 视频帧的GL绘制: 着色器, 各分量纹理和像素缓冲对象环
+ * 由OpenGLWidget(GUI线程)和VideoWindow(渲染线程)共用, 所有函数需在同一上下文为当前时调用
+ */
+class VideoRenderer : public QOpenGLExtraFunctions
+{
+public:
+    VideoRenderer();
+
+    bool initialize();
+    // 释放GL资源, 上下文销毁前调用
+    void destroy();
+    // 首帧到达前按视频尺寸和像素格式分配纹理存储, 与已分配的一致时不做处理
+    void prepareTextures(int width, int height, int format);
+    // 把帧拷贝到下一个像素缓冲对象, 再从中异步上传到纹理, 返回后帧即可释放
+    void uploadFrame(const VideoFrame *frame);
+    // 保持宽高比把当前纹理绘制到width x height的视口中
+    void draw(int width, int height);
+    inline bool hasFrame() const {return m_frameUploaded;}
+
+private:
+    // 由像素格式决定的纹理布局
+    struct TextureLayout{
+        int planes = 0; // 3: Y/U/V各一张纹理, 2: Y + 交错的UV, 0: 不支持
+        int chromaShiftW = 0; // 色度宽高相对亮度右移的位数
+        int chromaShiftH = 0;
+        int bytesPerSample = 1; // 高于8位的数据存放在16位中
+        float scale = 1.f; // 纹理采样值到[0, 1]的放大系数
+    };
+    // 着色器变体, 平面与半平面格式各一个
+    struct ShaderProgram{
+        QOpenGLShaderProgram *shader = nullptr;
+        GLint texture[3] = {-1, -1, -1}; // 各分量的采样器位置
+        GLint transform = -1; // 用于传递变换矩阵
+        GLint scale = -1;
+    };
+    // 像素缓冲对象环中的一个槽位
+    struct PixelBuffer{
+        GLuint id = 0;
+        GLsizeiptr size = 0;
+        GLsync fence = nullptr; // 从该缓冲上传纹理的命令完成后触发
+    };
+
+    static TextureLayout textureLayout(int format);
+    bool createProgram(ShaderProgram *program, const char *fragment, const char *const names[3]);
+    // 按尺寸和格式重新创建各分量的不可变纹理存储
+    void allocateTextures(int width, int height, int format);
+
+    PixelBuffer m_pixelBuffers[PBO_RING_SIZE];
+    int m_pixelBufferIndex = 0;
+
+    // 顶点缓冲区对象
+    QOpenGLBuffer vbo;
+    ShaderProgram m_planarProgram;
+    ShaderProgram m_semiPlanarProgram;
+
+    // 纹理
+    QOpenGLTexture *textureY = nullptr;
+    QOpenGLTexture *textureU = nullptr;
+    QOpenGLTexture *textureV = nullptr;
+
+    // 纹理ID, 失败返回0
+    GLuint m_idY = 0, m_idU = 0, m_idV = 0;
+    // 已分配的纹理尺寸和格式, 相同的帧只更新数据
+    int m_textureWidth = 0;
+    int m_textureHeight = 0;
+    int m_textureFormat = -1;
+    bool m_frameUploaded = false; // 当前纹理存储中已有完整的一帧
+    TextureLayout m_layout;
+
+    // 00 01 02 03
+    // 10 11 12 13
+    // 20 21 22 33
+    // 30 31 32 33
+    // 00: x 方向的缩放因子    10: y 方向的剪切因子  20: z 方向的剪切因子
+    // 01: x 方向的剪切      11: y 方向的缩放因子   21: z 方向的缩放因子
+    // 02: x 方向的平移      12: y 方向的平移     22: z 方向的深度
+    Eigen::Matrix4f m_transform;
+};
+
+#endif // VIDEO_RENDERER_H
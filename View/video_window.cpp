@@ -0,0 +1,231 @@
+#include "video_window.h"
+#include "VideoFrame.h"
+#include <QOpenGLContext>
+#include <QScreen>
+#include <QsLog.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+extern "C"{
+#include <libavutil/time.h>
+}
+
+VideoWindow::VideoWindow(QWindow *parent)
+    :QWindow(parent)
+{
+    setSurfaceType(QWindow::OpenGLSurface);
+    QSurfaceFormat format = QSurfaceFormat::defaultFormat();
+    format.setSwapInterval(1); // 每次交换等待一次垂直同步
+    setFormat(format);
+}
+
+VideoWindow::~VideoWindow()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_exit = true;
+    }
+    m_cond.notify_all();
+    m_thread.joinAll(); // 原生窗口销毁前结束渲染线程
+    Stats stats = this->stats();
+    QLOG_INFO() << "render thread: presented" << stats.presented << "dropped" << stats.dropped
+                << "missed vsync" << stats.missed << "max late" << stats.maxLateMs << "ms";
+}
+
+void VideoWindow::submitFrame(QSharedPointer<VideoFrame> frame, double pts, double targetTime)
+{
+    if(frame.isNull() || !frame->isValid()) return;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(m_frames.size() >= RENDER_QUEUE_SIZE){
+            m_frames.pop_front();
+            m_stats.dropped++;
+        }
+        m_frames.push_back(PendingFrame{frame, pts, targetTime, m_generation.load()});
+    }
+    m_cond.notify_all();
+}
+
+void VideoWindow::flushFrames()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_frames.clear();
+    m_generation++;
+}
+
+void VideoWindow::setPresentCallback(PresentCallback callback)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_presentCallback = callback;
+}
+
+void VideoWindow::prepareTextures(int width, int height, int format)
+{
+    if(width <= 0 || height <= 0) return;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_prepareWidth = width;
+        m_prepareHeight = height;
+        m_prepareFormat = format;
+    }
+    m_cond.notify_all();
+}
+
+VideoWindow::Stats VideoWindow::stats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+void VideoWindow::exposeEvent(QExposeEvent *event)
+{
+    Q_UNUSED(event);
+    updateSurface();
+    // 首次显示时原生窗口已创建, 此时才能在渲染线程中绑定上下文
+    if(isExposed() && m_thread.empty()){
+        if(!QOpenGLContext::supportsThreadedOpenGL()){
+            QLOG_ERROR() << "threaded opengl is not supported, render thread disabled";
+            emit renderThreadFailed();
+            return;
+        }
+        m_thread.start("render", [this](){
+            this->renderLoop();
+        });
+    }
+}
+
+void VideoWindow::resizeEvent(QResizeEvent *event)
+{
+    Q_UNUSED(event);
+    updateSurface();
+}
+
+void VideoWindow::mouseReleaseEvent(QMouseEvent *event)
+{
+    Q_UNUSED(event);
+    emit mouseReleased();
+}
+
+void VideoWindow::mouseDoubleClickEvent(QMouseEvent *event)
+{
+    Q_UNUSED(event);
+    emit mouseDoubleClicked();
+}
+
+void VideoWindow::updateSurface()
+{
+    double rate = screen() ? screen()->refreshRate() : 0.0;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_exposed = isExposed();
+        m_surfaceWidth = (int)(width() * devicePixelRatio());
+        m_surfaceHeight = (int)(height() * devicePixelRatio());
+        m_refreshInterval = 1.0 / (rate > 1.0 ? rate : RENDER_DEFAULT_REFRESH_RATE);
+        m_redraw = true;
+    }
+    m_cond.notify_all();
+}
+
+void VideoWindow::renderLoop()
+{
+    QOpenGLContext context;
+    context.setFormat(requestedFormat());
+    if(!context.create() || !context.makeCurrent(this)){
+        QLOG_ERROR() << "create render thread context fail";
+        emit renderThreadFailed();
+        return;
+    }
+    if(!m_renderer.initialize()){
+        m_renderer.destroy();
+        context.doneCurrent();
+        emit renderThreadFailed();
+        return;
+    }
+    emit renderThreadStarted();
+
+    double lastPresent = 0.0; // 上一次交换完成的时刻, 即上一次垂直同步
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while(!m_exit){
+        if(m_prepareWidth > 0){
+            int width = m_prepareWidth;
+            int height = m_prepareHeight;
+            int format = m_prepareFormat;
+            m_prepareWidth = 0;
+            lock.unlock();
+            m_renderer.prepareTextures(width, height, format);
+            lock.lock();
+            continue;
+        }
+
+        const double interval = m_refreshInterval;
+        double now = av_gettime_relative() / 1000000.0;
+        // 由上一次垂直同步和刷新周期推算下一次
+        double nextVsync = now;
+        if(lastPresent > 0 && now > lastPresent){
+            nextVsync = lastPresent + std::ceil((now - lastPresent) / interval) * interval;
+        }
+        // 取出在下一次垂直同步(前后半个周期)之前到期的最后一帧, 更早的已来不及显示
+        PendingFrame pending;
+        bool due = false;
+        while(!m_frames.empty() && m_frames.front().targetTime <= nextVsync + interval / 2){
+            if(due) m_stats.dropped++;
+            pending = m_frames.front();
+            m_frames.pop_front();
+            due = true;
+        }
+        if(!due && !m_redraw){
+            if(m_frames.empty()){
+                m_cond.wait(lock); // 等待新帧, 纹理分配, 尺寸变化或退出
+            }
+            else{
+                // 提前一个周期醒来, 之后阻塞在交换缓冲上对齐垂直同步
+                double wait = std::max(0.001, m_frames.front().targetTime - interval - now);
+                m_cond.wait_for(lock, std::chrono::microseconds((int64_t)(wait * 1000000)));
+            }
+            continue;
+        }
+        m_redraw = false;
+        bool exposed = m_exposed;
+        int width = m_surfaceWidth;
+        int height = m_surfaceHeight;
+        PresentCallback callback = m_presentCallback;
+        lock.unlock();
+
+        if(due && pending.generation != m_generation.load()){
+            due = false; // 取出后被flushFrames()作废, 例如跳转前的帧
+            pending.frame.reset();
+        }
+        if(due){
+            m_renderer.uploadFrame(pending.frame.data());
+            pending.frame.reset(); // 已拷贝到像素缓冲对象, 解码缓冲尽早归还
+        }
+        double presentTime = now;
+        if(exposed){
+            m_renderer.glViewport(0, 0, width, height);
+            m_renderer.draw(width, height);
+            context.swapBuffers(this);
+            // 部分驱动的交换只是排队, 等命令真正完成后的时刻才对应实际显示
+            m_renderer.glFinish();
+            presentTime = av_gettime_relative() / 1000000.0;
+            lastPresent = presentTime;
+        }
+        else if(due){
+            presentTime = std::max(now, pending.targetTime); // 窗口不可见, 按期望时刻推进时钟
+        }
+        if(due && callback && pending.generation == m_generation.load()){
+            callback(pending.pts, presentTime);
+        }
+
+        lock.lock();
+        if(due){
+            double lateMs = (presentTime - pending.targetTime) * 1000.0;
+            m_stats.presented++;
+            if(lateMs > interval * 1000.0) m_stats.missed++;
+            m_stats.maxLateMs = std::max(m_stats.maxLateMs, lateMs);
+        }
+    }
+    lock.unlock();
+    m_renderer.destroy();
+    context.doneCurrent();
+}
@@ -0,0 +1,94 @@
+#ifndef VIDEO_WINDOW_H
+#define VIDEO_WINDOW_H
+
+#include <QWindow>
+#include <deque>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include "video_renderer.h"
+#include "VideoPresenter.h"
+#include "PipelineThreads.h"
+
+// 渲染队列中最多等待显示的帧数, 满时丢弃最早的
+#define RENDER_QUEUE_SIZE 3
+// 拿不到屏幕刷新率时假定的值
+#define RENDER_DEFAULT_REFRESH_RATE 60.0
+
+/**
+ * @brief 由独立渲染线程绘制的视频窗口, 通过QWidget::createWindowContainer嵌入界面
+ * 渲染线程持有自己的上下文(交换间隔为1), 负责上传, 绘制和交换缓冲, 不经过GUI线程的事件循环
+ * 每帧在其期望时刻所在的垂直同步周期显示, 交换完成的时刻作为实际显示时刻回报给播放器
+ */
+class VideoWindow : public QWindow, public VideoPresenter
+{
+    Q_OBJECT
+
+public:
+    struct Stats{
+        int64_t presented = 0;
+        int64_t dropped = 0; // 来不及显示被后一帧取代, 或队列已满
+        int64_t missed = 0; // 晚于期望时刻超过一个刷新周期才显示
+        double maxLateMs = 0.0;
+    };
+
+    explicit VideoWindow(QWindow *parent = nullptr);
+    ~VideoWindow();
+
+    void submitFrame(QSharedPointer<VideoFrame> frame, double pts, double targetTime) override;
+    void flushFrames() override;
+    void setPresentCallback(PresentCallback callback) override;
+    // 首帧到达前由渲染线程按视频尺寸和像素格式分配纹理存储
+    void prepareTextures(int width, int height, int format);
+    Stats stats() const;
+
+signals:
+    // 渲染线程已创建上下文并开始工作, 之后才能把窗口交给播放器
+    void renderThreadStarted();
+    // 不支持多线程GL或上下文创建失败, 渲染线程没有运行
+    void renderThreadFailed();
+    void mouseReleased();
+    void mouseDoubleClicked();
+
+protected:
+    virtual void exposeEvent(QExposeEvent *event) override;
+    virtual void resizeEvent(QResizeEvent *event) override;
+    virtual void mouseReleaseEvent(QMouseEvent *event) override;
+    virtual void mouseDoubleClickEvent(QMouseEvent *event) override;
+
+private:
+    struct PendingFrame{
+        QSharedPointer<VideoFrame> frame;
+        double pts = 0.0;
+        double targetTime = 0.0;
+        int generation = 0; // 提交时的m_generation
+    };
+
+    void renderLoop();
+    // 原生窗口已创建, 由GUI线程记录尺寸和刷新率后唤醒渲染线程重绘
+    void updateSurface();
+
+    VideoRenderer m_renderer; // 只在渲染线程中使用
+    PipelineThreads m_thread;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::deque<PendingFrame> m_frames;
+    PresentCallback m_presentCallback;
+    // flushFrames()时递增, 已从队列取出但属于之前的帧不再显示
+    std::atomic_int m_generation{0};
+    bool m_exit = false;
+    bool m_redraw = false; // 尺寸变化或重新显示, 需要重绘当前纹理
+    bool m_exposed = false;
+    // 物理像素尺寸
+    int m_surfaceWidth = 0;
+    int m_surfaceHeight = 0;
+    double m_refreshInterval = 1.0 / RENDER_DEFAULT_REFRESH_RATE;
+    // 待分配的纹理, 宽度为0表示没有
+    int m_prepareWidth = 0;
+    int m_prepareHeight = 0;
+    int m_prepareFormat = -1;
+    Stats m_stats;
+};
+
+#endif // VIDEO_WINDOW_H
@@ -1,13 +1,16 @@
 #include "widget.h"
 #include "ui_widget.h"
 #include "AVPlayer.h"
-#include "YUV422Frame.h"
+#include "VideoFrame.h"
 #include "MsgBox.h"
 #include <QFileDialog>
 #include <QPainter>
 
 // 声名后才能使用关于这个类型的槽函数
-Q_DECLARE_METATYPE(QSharedPointer<YUV422Frame>)
+Q_DECLARE_METATYPE(QSharedPointer<VideoFrame>)
+
+// 视频由独立渲染线程按垂直同步显示, 不受GUI线程事件循环负载的影响; 需要驱动支持多线程GL
+#define VIDEO_RENDER_THREAD false
 
 Widget::Widget(QWidget *parent) :
     QWidget(parent),
@@ -26,6 +29,15 @@ Widget::Widget(QWidget *parent) :
 
     // 展现视频
     connect(m_player, &AVPlayer::frameChanged, ui->opengl_widget, &OpenGLWidget::showYUV, Qt::QueuedConnection);
+    // 排队到play()返回后执行, 与解码器打开/首帧解码并行
+    connect(m_player, &AVPlayer::videoSizeChanged, ui->opengl_widget, &OpenGLWidget::prepareTextures, Qt::QueuedConnection);
+    if(VIDEO_RENDER_THREAD){
+        // 渲染线程启动后才切换, 在此之前及启动失败时帧仍通过frameChanged显示
+        connect(ui->opengl_widget, &OpenGLWidget::presenterReady, this, [this](VideoPresenter *presenter){
+            m_player->setVideoPresenter(presenter);
+        });
+        ui->opengl_widget->enableRenderThread();
+    }
 
     // 添加文件
     connect(ui->btn_addFile, &QPushButton::clicked, this, &Widget::addFile);
@@ -60,6 +72,7 @@ Widget::Widget(QWidget *parent) :
 
 Widget::~Widget()
 {
+    m_player->initPlayer(); // 视频线程先于渲染窗口结束
     delete ui;
 }
 
@@ -67,9 +80,15 @@ Widget::~Widget()
 void Widget::playSlot()
 {
     terminateSlot();
-    const QString url = ui->lineEdit_input->text();
-    if(url.count()){
-        if(m_player->play(url)){
+    // 多个文件以';'分隔, 按顺序连续播放
+#if(QT_VERSION >= QT_VERSION_CHECK(5, 14, 0))
+    const QStringList urls = ui->lineEdit_input->text().split(';', Qt::SkipEmptyParts);
+#else
+    const QStringList urls = ui->lineEdit_input->text().split(';', QString::SkipEmptyParts);
+#endif
+    if(urls.count()){
+        m_player->setPlaylist(urls);
+        if(m_player->playIndex(0)){
             //ui->btn_play->setEnabled(false);
             ui->btn_forward->setEnabled(true);
             ui->btn_back->setEnabled(true);
@@ -105,8 +124,9 @@ void Widget::initUi()
 
 void Widget::addFile()
 {
-    QString url = QFileDialog::getOpenFileName(this, "chose file", QDir::currentPath(), m_formatFilter);
-    ui->lineEdit_input->setText(url);
+    QStringList urls = QFileDialog::getOpenFileNames(this, "chose file", QDir::currentPath(), m_formatFilter);
+    if(urls.isEmpty()) return;
+    ui->lineEdit_input->setText(urls.join(';'));
 }
 
 void Widget::durationChangedSlot(uint32_t duration)
@@ -134,7 +154,9 @@ void Widget::terminateSlot()
 void Widget::avPtsChangedSlot(unsigned int pts)
 {
     if(m_ptsSliderPressed) return;
-    ui->slider_AVPts->setPtsPercent((double)pts / m_duration);
+    if(m_duration > 0){ // 直播没有时长
+        ui->slider_AVPts->setPtsPercent((double)pts / m_duration);
+    }
     ui->label_pts->setText(QString("%1:%2").arg(pts / 60, 2, 10, QLatin1Char('0'))
                                         .arg(pts % 60, 2, 10, QLatin1Char('0')));
 }
@@ -175,6 +197,8 @@ void Widget::ptsSliderMovedSlot(int position)
                                             .arg(m_seekTarget % 60, 2, 10, QLatin1Char('0'));
     if(m_ptsSliderPressed){
         ui->label_pts->setText(ptsStr);
+        // 拖动时快速预览关键帧, 只有最新的位置会被执行
+        m_player->seekTo(m_seekTarget, Decoder::SEEK_FAST);
     }else{
         ui->slider_AVPts->setToolTip(ptsStr); // 指着进度条
     }